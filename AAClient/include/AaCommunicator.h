@@ -24,11 +24,13 @@ class AaCommunicator {
   SSL *ssl = nullptr;
   BIO *readBio = nullptr;
   BIO *writeBio = nullptr;
-  bool doSslHandshake(const std::vector<uint8_t> msgContent);
-  std::vector<uint8_t> decryptMessage(const std::vector<uint8_t> &encryptedMsg);
+  bool doSslHandshake(const ByteBuffer &msgContent);
+  void decryptMessage(const uint8_t *encrypted, size_t size,
+                      ByteBuffer &plain);
+  // TLS record header, MAC and padding, upper bound
+  static constexpr size_t recordOverhead = 256;
 
-  void sendMessage(uint8_t channel, uint8_t flags,
-                   const std::vector<uint8_t> &buf);
+  void sendMessage(uint8_t channel, uint8_t flags, std::vector<uint8_t> buf);
   Message getMessage();
   void sendVersionRequest(uint16_t major, uint16_t minor);
   void expectVersionResponse();
@@ -39,8 +41,13 @@ class AaCommunicator {
 
   const std::vector<uint8_t> &serviceDescription;
   std::mutex sendQueueMutex;
-  std::deque<Message> sendQueue;
+  std::deque<OutgoingMessage> sendQueue;
   std::condition_variable sendQueueNotEmpty;
+  std::condition_variable sendQueueNotFull;
+  // bytes waiting in sendQueue, producers block above sendQueueBudget
+  size_t sendQueueBytes = 0;
+  const size_t sendQueueBudget = 16 << 20;
+  size_t fragmentSize = 10000;
 
   void writeThread();
   void writeToUsb(const std::vector<uint8_t> &buffer);
@@ -55,8 +62,9 @@ public:
   ~AaCommunicator();
   void setup();
   boost::signals2::signal<void(uint8_t channelNumber, bool specific,
-                               const std::vector<uint8_t> &msg)>
+                               const ByteBuffer &msg)>
       channelMessage;
   void sendMessagePublic(uint8_t channel, bool specific,
                          const std::vector<uint8_t> &buf);
+  void setFragmentSize(size_t size);
 };
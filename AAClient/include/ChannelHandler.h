@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "ByteBuffer.h"
 #include <boost/signals2.hpp>
 #include <vector>
 
@@ -12,11 +13,11 @@ protected:
 public:
   ChannelHandler(uint8_t channelId);
   virtual bool handleMessageFromMobile(uint8_t channelId, uint8_t flags,
-                                       const std::vector<uint8_t> &data) = 0;
+                                       const ByteBuffer &data) = 0;
   virtual bool handleMessageFromServer(uint8_t channelId, bool specific,
                                        const std::vector<uint8_t> &data) = 0;
   boost::signals2::signal<void(uint8_t channelNumber, bool specific,
-                               std::vector<uint8_t> data)>
+                               const ByteBuffer &data)>
       sendToServer;
   boost::signals2::signal<void(uint8_t channelNumber, uint8_t flags,
                                std::vector<uint8_t> data)>
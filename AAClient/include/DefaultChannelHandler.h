@@ -9,7 +9,7 @@ public:
   DefaultChannelHandler(uint8_t channelId);
   virtual ~DefaultChannelHandler();
   virtual bool handleMessageFromMobile(uint8_t channelId, uint8_t flags,
-                                       const std::vector<uint8_t> &data);
+                                       const ByteBuffer &data);
   virtual bool handleMessageFromServer(uint8_t channelId, bool specific,
                                        const std::vector<uint8_t> &data);
 };
@@ -12,7 +12,7 @@ public:
   InputChannelHandler(uint8_t channelId);
   virtual ~InputChannelHandler();
   virtual bool handleMessageFromMobile(uint8_t channelId, uint8_t flags,
-                                       const std::vector<uint8_t> &data);
+                                       const ByteBuffer &data);
   virtual bool handleMessageFromServer(uint8_t channelId, bool specific,
                                        const std::vector<uint8_t> &data);
 };
@@ -1,13 +1,26 @@
 #pragma once
 
-#include <vector>
+#include "ByteBuffer.h"
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 class Message {
 public:
   Message();
   uint8_t channel;
   uint8_t flags;
-  std::vector<uint8_t> content;
-  int offset;
+  ByteBuffer content;
+};
+
+// Entry of the send queue. The payload is shared and never modified once
+// queued, the pump only advances offset while cutting it into frames.
+class OutgoingMessage {
+public:
+  OutgoingMessage(uint8_t channel, uint8_t flags,
+                  std::shared_ptr<const std::vector<uint8_t>> content);
+  uint8_t channel;
+  uint8_t flags;
+  std::shared_ptr<const std::vector<uint8_t>> content;
+  size_t offset;
 };
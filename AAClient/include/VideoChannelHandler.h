@@ -14,14 +14,15 @@ class VideoChannelHandler : public ChannelHandler {
   GstElement *pipeline;
   GstElement* app_source;
   void createAppSource();
-  void pushDataToPipeline(uint64_t ts, const std::vector<uint8_t>& data);
+  // data is copied into the gstreamer buffer
+  void pushDataToPipeline(uint64_t ts, const uint8_t *data, size_t size);
   uint64_t startTimestamp;
 
 public:
   VideoChannelHandler(uint8_t channelId);
   virtual ~VideoChannelHandler();
   virtual bool handleMessageFromMobile(uint8_t channelId, uint8_t flags,
-                                       const std::vector<uint8_t> &data);
+                                       const ByteBuffer &data);
   virtual bool handleMessageFromServer(uint8_t channelId, bool specific,
                                        const std::vector<uint8_t> &data);
 };
@@ -4,7 +4,10 @@
 #include "Library.h"
 #include "Message.h"
 #include "utils.h"
+#include <cctype>
+#include <cerrno>
 #include <cstdint>
+#include <cstdlib>
 #include <fmt/core.h>
 #include <gst/gst.h>
 #include <iterator>
@@ -43,7 +46,30 @@ vector<uint8_t> getServiceDescriptor(int fd) {
   return vector<uint8_t>(buffer, buffer + ret);
 }
 
+// false unless text is a plain decimal number
+bool parseSize(const char *text, size_t &size) {
+  if (!isdigit((unsigned char)text[0]))
+    return false;
+  char *end;
+  errno = 0;
+  auto value = strtoul(text, &end, 10);
+  if (*end != '\0' || errno == ERANGE)
+    return false;
+  size = value;
+  return true;
+}
+
 int main(int argc, char **argv) {
+  if (argc < 2) {
+    cout << "usage: " << argv[0] << " socket [fragment size]" << endl;
+    return 1;
+  }
+  size_t fragmentSize = 0;
+  if (argc > 2 && !parseSize(argv[2], fragmentSize)) {
+    cout << "fragment size must be a number of bytes, got " << argv[2]
+         << endl;
+    return 1;
+  }
   Library lib;
   for (auto dev : lib.getDeviceList()) {
     try {
@@ -71,6 +97,8 @@ int main(int argc, char **argv) {
   cout << "got sd" << endl;
   gst_init(&argc, &argv);
   AaCommunicator communicator(*device, sd);
+  if (argc > 2)
+    communicator.setFragmentSize(fragmentSize);
   int hi = 0;
   auto th = std::thread([fd, &communicator, &hi]() {
     try {
@@ -98,8 +126,7 @@ int main(int argc, char **argv) {
   });
   int pi = 0;
   communicator.channelMessage.connect(
-      [fd, &pi](uint8_t channel, bool specific,
-                const std::vector<uint8_t> &msg) {
+      [fd, &pi](uint8_t channel, bool specific, const ByteBuffer &msg) {
         try {
           vector<uint8_t> message;
           message.push_back(0x01); // raw data
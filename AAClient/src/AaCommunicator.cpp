@@ -36,8 +36,7 @@ AaCommunicator::AaCommunicator(const Device &dev,
   initializeSslContext();
   channelHandlers[0] = new DefaultChannelHandler(0);
   channelHandlers[0]->sendToServer.connect(
-      [this](uint8_t channelNumber, bool specific,
-             const std::vector<uint8_t> &data) {
+      [this](uint8_t channelNumber, bool specific, const ByteBuffer &data) {
         channelMessage(channelNumber, specific, data);
       });
   channelHandlers[0]->sendToMobile.connect(
@@ -56,7 +55,7 @@ void AaCommunicator::setup() {
   sendVersionRequest(1, 1);
   expectVersionResponse();
   cout << "version negotiation ok" << endl;
-  auto message = vector<uint8_t>();
+  auto message = ByteBuffer();
   while (!doSslHandshake(message))
     message = getMessage().content;
   cout << "ssl handshake complete" << endl;
@@ -115,7 +114,7 @@ void AaCommunicator::handleServiceDiscoveryRequest(const Message &msg) {
     }
     channelHandlers[ch.channel_id()]->sendToServer.connect(
         [this](uint8_t channelNumber, bool specific,
-               const std::vector<uint8_t> &data) {
+               const ByteBuffer &data) {
           channelMessage(channelNumber, specific, data);
         });
     channelHandlers[ch.channel_id()]->sendToMobile.connect(
@@ -127,7 +126,7 @@ void AaCommunicator::handleServiceDiscoveryRequest(const Message &msg) {
   sendMessage(0,
               EncryptionType::Encrypted | FrameType::Bulk |
                   MessageTypeFlags::Control,
-              message);
+              std::move(message));
 }
 
 void AaCommunicator::handleChannelMessage(const Message &msg) {
@@ -147,10 +146,10 @@ void AaCommunicator::sendAuthComplete() {
   msg.push_back(0x00);
   sendMessage(
       0, FrameType::Bulk | EncryptionType::Plain | MessageTypeFlags::Control,
-      msg);
+      std::move(msg));
 }
 
-bool AaCommunicator::doSslHandshake(const vector<uint8_t> msgContent) {
+bool AaCommunicator::doSslHandshake(const ByteBuffer &msgContent) {
   initializeSsl();
   if (msgContent.size() > 2) {
     if ((msgContent[0] << 8 | msgContent[1]) != MessageType::SslHandshake)
@@ -178,7 +177,7 @@ bool AaCommunicator::doSslHandshake(const vector<uint8_t> msgContent) {
   while ((len = BIO_read(writeBio, buffer, bufferSize)) != -1) {
     std::copy(buffer, buffer + len, std::back_inserter(msg));
   }
-  sendMessage(0, EncryptionType::Plain | FrameType::Bulk, msg);
+  sendMessage(0, EncryptionType::Plain | FrameType::Bulk, std::move(msg));
   // cout << "send=" << msg.size() << endl;
   return false;
 }
@@ -242,7 +241,7 @@ void AaCommunicator::sendVersionRequest(uint16_t major, uint16_t minor) {
   pushBackInt16(buf, minor);
   sendMessage(
       0, EncryptionType::Plain | FrameType::Bulk | MessageTypeFlags::Control,
-      buf);
+      std::move(buf));
 }
 
 void AaCommunicator::expectVersionResponse() {
@@ -259,18 +258,26 @@ void AaCommunicator::sendMessagePublic(uint8_t channel, bool specific,
 }
 
 void AaCommunicator::sendMessage(uint8_t channel, uint8_t flags,
-                                 const std::vector<uint8_t> &buf) {
-  Message msg;
-  msg.channel = channel;
-  msg.flags = flags;
-  msg.content = buf;
+                                 std::vector<uint8_t> buf) {
+  auto content = make_shared<const std::vector<uint8_t>>(std::move(buf));
   {
     std::unique_lock<std::mutex> lk(sendQueueMutex);
-    sendQueue.push_back(msg);
+    sendQueueNotFull.wait(lk, [&] {
+      return sendQueueBytes == 0 ||
+             sendQueueBytes + content->size() <= sendQueueBudget;
+    });
+    sendQueueBytes += content->size();
+    sendQueue.emplace_back(channel, flags, std::move(content));
   }
   sendQueueNotEmpty.notify_all();
 }
 
+void AaCommunicator::setFragmentSize(size_t size) {
+  // one frame has to hold a single TLS record with a 16 bit length
+  std::unique_lock<std::mutex> lk(sendQueueMutex);
+  fragmentSize = std::min(std::max(size, (size_t)256), (size_t)16384);
+}
+
 vector<uint8_t> AaCommunicator::prepareMessage() {
   vector<uint8_t> buffer;
   std::unique_lock<std::mutex> lk(sendQueueMutex);
@@ -278,63 +285,42 @@ vector<uint8_t> AaCommunicator::prepareMessage() {
     return buffer;
   }
 
-  int maxSize = 10000;
+  size_t maxSize = fragmentSize;
 
-  auto msg = sendQueue.front();
-  uint32_t totalLength = msg.content.size();
-  std::vector<uint8_t> msgBytes;
+  // the payload is only referenced, the queue entry keeps it alive until its
+  // last fragment has been written
+  auto &msg = sendQueue.front();
+  const auto &content = *msg.content;
+  uint32_t totalLength = content.size();
+  auto channel = msg.channel;
   if (msg.flags & EncryptionType::Encrypted) {
-    msgBytes.push_back(msg.channel);
-    auto flags = msg.flags;
-    std::vector<uint8_t>::iterator contentBegin;
-    std::vector<uint8_t>::iterator contentEnd;
-    // full frame
-    if (msg.content.size() - msg.offset <= maxSize &&
-        (flags & FrameType::Bulk)) {
-      contentBegin = msg.content.begin() + msg.offset;
-      contentEnd = msg.content.end();
-      sendQueue.pop_front();
-    }
-    // first frame
-    else if (msg.content.size() - msg.offset > maxSize &&
-             (flags & FrameType::Bulk)) {
-      flags = flags & ~FrameType::Bulk;
-      flags = flags | FrameType::First;
-      contentBegin = msg.content.begin() + msg.offset;
-      contentEnd = msg.content.begin() + msg.offset + maxSize;
-      sendQueue.front().flags = flags & ~FrameType::Bulk;
-      sendQueue.front().offset += maxSize;
-    }
-    // intermediate frame
-    else if (msg.content.size() - msg.offset > maxSize) {
-      contentBegin = msg.content.begin() + msg.offset;
-      contentEnd = msg.content.begin() + msg.offset + maxSize;
-      sendQueue.front().flags = flags & ~FrameType::Bulk;
-      sendQueue.front().offset += maxSize;
-    }
-    // last frame
-    else {
-      contentBegin = msg.content.begin() + msg.offset;
-      contentEnd = msg.content.end();
-      flags = flags | FrameType::Last;
-      sendQueue.pop_front();
-    }
-    msgBytes.push_back(flags);
-    auto ret = SSL_write(ssl, contentBegin.base(), contentEnd - contentBegin);
+    auto fragmentLength = std::min(content.size() - msg.offset, maxSize);
+    auto flags = msg.flags & ~FrameType::Bulk;
+    if (msg.offset == 0)
+      flags |= FrameType::First;
+    if (msg.offset + fragmentLength == content.size())
+      flags |= FrameType::Last;
+    auto ret = SSL_write(ssl, content.data() + msg.offset, fragmentLength);
     if (ret < 0) {
       throw std::runtime_error("SSL_write error");
     }
+    msg.offset += fragmentLength;
+    if (msg.offset == content.size()) {
+      sendQueueBytes -= content.size();
+      sendQueue.pop_front();
+      sendQueueNotFull.notify_all();
+    }
     lk.unlock();
     uint8_t encBuf[20000];
     auto offset = 4;
     if ((flags & FrameType::Bulk) == FrameType::First) {
       offset += 4;
     }
-    auto length = BIO_read(writeBio, encBuf + offset, 20000);
+    auto length = BIO_read(writeBio, encBuf + offset, 20000 - offset);
     if (length < 0) {
       throw std::runtime_error("BIO_read error");
     }
-    encBuf[0] = msg.channel;
+    encBuf[0] = channel;
     encBuf[1] = flags;
     encBuf[2] = (length >> 8);
     encBuf[3] = (length & 0xff);
@@ -346,15 +332,15 @@ vector<uint8_t> AaCommunicator::prepareMessage() {
     }
     return vector<uint8_t>(encBuf, encBuf + length + offset);
   } else {
+    buffer.reserve(totalLength + 4);
+    buffer.push_back(channel);
+    buffer.push_back(msg.flags);
+    pushBackInt16(buffer, totalLength);
+    std::copy(content.begin(), content.end(), std::back_inserter(buffer));
+    sendQueueBytes -= content.size();
     sendQueue.pop_front();
-    msgBytes.push_back(msg.channel);
-    msgBytes.push_back(msg.flags);
-    int length = msg.content.size();
-    pushBackInt16(msgBytes, length);
-    std::copy(msg.content.begin(), msg.content.end(),
-              std::back_inserter(msgBytes));
-    // std::copy(msgBytes.begin(), msgBytes.end(), (uint8_t *)buf);
-    return msgBytes;
+    sendQueueNotFull.notify_all();
+    return buffer;
   }
 }
 
@@ -433,7 +419,7 @@ Message AaCommunicator::getMessage() {
   uint8_t buffer[bufSize];
   int transferred;
   int result;
-  vector<uint8_t> fullContent;
+  ByteBuffer fullContent;
   int totalLength = 0;
   Message msg;
   msg.flags = 0;
@@ -450,19 +436,23 @@ Message AaCommunicator::getMessage() {
       totalLength =
           (buffer[4] << 24 | buffer[5] << 16 | buffer[6] << 8 | buffer[7]);
       offset += 4;
+      // records are slightly longer than their plaintext and are decrypted
+      // in place at the end of fullContent
+      fullContent.reserve(totalLength + recordOverhead);
     }
-    auto content = vector<uint8_t>(buffer + offset, buffer + transferred);
-    if (length != content.size()) {
+    if (length != transferred - offset) {
       cout << (msg.flags & FrameType::Bulk) << " " << length << " "
-           << content.size() << endl;
+           << transferred - offset << endl;
       throw runtime_error("wrong length");
     }
     if (msg.flags & EncryptionType::Encrypted) {
-      content = decryptMessage(content);
+      decryptMessage(buffer + offset, length, fullContent);
+    } else {
+      fullContent.insert(fullContent.end(), buffer + offset,
+                         buffer + offset + length);
     }
-    copy(content.begin(), content.end(), back_inserter(fullContent));
   } while (fullContent.size() < totalLength);
-  msg.content = fullContent;
+  msg.content = std::move(fullContent);
   msg.flags |= FrameType::Bulk;
   // if (totalLength != 0)
   // cout << "totalLength: " << totalLength << " " << msg.content.size() <<
@@ -470,16 +460,19 @@ Message AaCommunicator::getMessage() {
   return msg;
 }
 
-std::vector<uint8_t>
-AaCommunicator::decryptMessage(const std::vector<uint8_t> &encryptedMsg) {
+void AaCommunicator::decryptMessage(const uint8_t *encrypted, size_t size,
+                                    ByteBuffer &plain) {
   ERR_clear_error();
 
-  auto ret = BIO_write(readBio, encryptedMsg.data(), encryptedMsg.size());
+  auto ret = BIO_write(readBio, encrypted, size);
   if (ret < 0) {
     throw std::runtime_error("BIO_write failed");
   }
-  char plainBuf[20000];
-  ret = SSL_read(ssl, plainBuf, 20000);
+  // plaintext is never longer than the record carrying it; resize leaves the
+  // added bytes uninitialized, SSL_read overwrites them
+  auto offset = plain.size();
+  plain.resize(offset + size);
+  ret = SSL_read(ssl, plain.data() + offset, size);
   if (ret < 0) {
     auto err = SSL_get_error(ssl, ret);
     auto message = "SSL_read failed: " + std::to_string(ret);
@@ -488,5 +481,5 @@ AaCommunicator::decryptMessage(const std::vector<uint8_t> &encryptedMsg) {
       message += " "s + ERR_error_string(ERR_get_error(), NULL);
     throw std::runtime_error(message);
   }
-  return std::vector<uint8_t>(plainBuf, plainBuf + ret);
+  plain.resize(offset + ret);
 }
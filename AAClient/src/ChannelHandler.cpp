@@ -7,7 +7,7 @@ ChannelHandler::ChannelHandler(uint8_t _channelId) : channelId(_channelId) {}
 ChannelHandler::~ChannelHandler() {}
 
 bool ChannelHandler::handleMessageFromMobile(
-    uint8_t channelId, uint8_t flags, const std::vector<uint8_t> &data) {
+    uint8_t channelId, uint8_t flags, const ByteBuffer &data) {
   return false;
 }
 
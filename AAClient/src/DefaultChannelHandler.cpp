@@ -9,7 +9,7 @@ DefaultChannelHandler::DefaultChannelHandler(uint8_t channelId)
 DefaultChannelHandler::~DefaultChannelHandler() {}
 
 bool DefaultChannelHandler::handleMessageFromMobile(
-    uint8_t channelId, uint8_t flags, const std::vector<uint8_t> &data) {
+    uint8_t channelId, uint8_t flags, const ByteBuffer &data) {
   sendToServer(channelId, flags & MessageTypeFlags::Specific, data);
   return true;
 }
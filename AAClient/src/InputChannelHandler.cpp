@@ -12,7 +12,7 @@ InputChannelHandler::InputChannelHandler(uint8_t channelId)
 InputChannelHandler::~InputChannelHandler() {}
 
 bool InputChannelHandler::handleMessageFromMobile(
-    uint8_t channelId, uint8_t flags, const std::vector<uint8_t> &data) {
+    uint8_t channelId, uint8_t flags, const ByteBuffer &data) {
   const uint16_t *shortView = (const uint16_t *)(data.data());
   auto msgType = be16toh(shortView[0]);
   if (msgType == MessageType::ChannelOpenRequest) {
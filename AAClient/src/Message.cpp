@@ -1,3 +1,9 @@
 #include "Message.h"
 
-Message::Message() { offset = 0; }
+Message::Message() {}
+
+OutgoingMessage::OutgoingMessage(
+    uint8_t _channel, uint8_t _flags,
+    std::shared_ptr<const std::vector<uint8_t>> _content)
+    : channel(_channel), flags(_flags), content(std::move(_content)),
+      offset(0) {}
@@ -22,7 +22,7 @@ VideoChannelHandler::VideoChannelHandler(uint8_t channelId)
 VideoChannelHandler::~VideoChannelHandler() {}
 
 bool VideoChannelHandler::handleMessageFromMobile(
-    uint8_t channelId, uint8_t flags, const std::vector<uint8_t> &data) {
+    uint8_t channelId, uint8_t flags, const ByteBuffer &data) {
   const uint16_t *shortView = (const uint16_t *)(data.data());
   auto msgType = be16toh(shortView[0]);
   if (msgType == MessageType::ChannelOpenRequest) {
@@ -36,17 +36,17 @@ bool VideoChannelHandler::handleMessageFromMobile(
     return true;
   } else if (msgType == MediaMessageType::MediaIndication) {
     createAppSource();
-    pushDataToPipeline(0, vector(data.begin() + 2, data.end()));
+    pushDataToPipeline(0, data.data() + 2, data.size() - 2);
     sendAck();
     return true;
   } else if (msgType == MediaMessageType::MediaWithTimestampIndication) {
-    auto ts = bytesToUInt64(data, 2);
+    auto ts = bytesToUInt64(data.data(), data.size(), 2);
     if (startTimestamp == 0) {
       startTimestamp = ts - 100'000;
     }
     auto localTs = (ts - startTimestamp);
-    pushDataToPipeline(localTs * 1000,
-                       vector(data.begin() + 2 + 8, data.end()));
+    pushDataToPipeline(localTs * 1000, data.data() + 2 + 8,
+                       data.size() - 2 - 8);
     sendAck();
     return true;
   }
@@ -93,17 +93,17 @@ void VideoChannelHandler::createAppSource() {
   gst_element_set_state(pipeline, GST_STATE_PLAYING);
 }
 
-void VideoChannelHandler::pushDataToPipeline(uint64_t ts,
-                                             const std::vector<uint8_t> &data) {
+void VideoChannelHandler::pushDataToPipeline(uint64_t ts, const uint8_t *data,
+                                             size_t size) {
   cout << "pushDataToPipeline" << endl;
-  auto buffer = gst_buffer_new_and_alloc(data.size());
+  auto buffer = gst_buffer_new_and_alloc(size);
   if (ts) {
     GST_BUFFER_TIMESTAMP(buffer) = ts;
   }
 
   GstMapInfo map;
   gst_buffer_map(buffer, &map, GST_MAP_WRITE);
-  copy(data.begin(), data.end(), map.data);
+  copy(data, data + size, map.data);
   gst_buffer_unmap(buffer, &map);
 
   GstFlowReturn ret;
@@ -141,7 +141,7 @@ void VideoChannelHandler::sendSetupResponse() {
   pushBackInt16(msg, MediaMessageType::SetupResponse);
   tag::aas::MediaChannelSetupResponse mcsr;
   mcsr.set_unknown_field_1(2);
-  mcsr.set_unknown_field_2(1);
+  mcsr.set_max_unacked(1);
   mcsr.set_unknown_field_3(0);
   auto mcsrStr = mcsr.SerializeAsString();
   copy(mcsrStr.begin(), mcsrStr.end(), back_inserter(msg));
@@ -0,0 +1,68 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Delegate.h"
+#include "SharedBuffer.h"
+#include <atomic>
+#include <boost/signals2.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// same signature as AaCommunicator::gotMessage and ChannelHandler::sendToClient
+#define SIGNATURE                                                              \
+  void(int clientId, uint8_t channelNumber, bool specific,                     \
+       const SharedBuffer &data)
+
+static atomic<size_t> delivered{0};
+
+static void slot(int, uint8_t, bool, const SharedBuffer &data) {
+  delivered.fetch_add(data->size(), memory_order_relaxed);
+}
+
+// ns per emit, each of threadCount threads emits iterations times
+template <typename Signal>
+double run(Signal &signal, int threadCount, size_t iterations) {
+  auto data = make_shared<const ByteBuffer>(16);
+  vector<thread> threads;
+  auto start = chrono::steady_clock::now();
+  for (int t = 0; t < threadCount; ++t) {
+    threads.emplace_back([&signal, &data, iterations]() {
+      for (size_t i = 0; i < iterations; ++i)
+        signal(-1, 3, false, data);
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  auto ns = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start)
+                .count();
+  return (double)ns / (threadCount * iterations);
+}
+
+int main(int argc, char *argv[]) {
+  size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000;
+  cout << "cores: " << thread::hardware_concurrency()
+       << ", emits per thread: " << iterations << endl;
+  cout << "dispatch\tslots\tthreads\tnsPerEmit" << endl;
+  for (int slots : {1, 2}) {
+    boost::signals2::signal<SIGNATURE> signal;
+    Delegate<SIGNATURE> delegate;
+    for (int s = 0; s < slots; ++s) {
+      signal.connect(slot);
+      delegate.connect(slot);
+    }
+    for (int threads : {1, 4}) {
+      cout << "signals2\t" << slots << "\t" << threads << "\t"
+           << run(signal, threads, iterations) << endl;
+      cout << "Delegate\t" << slots << "\t" << threads << "\t"
+           << run(delegate, threads, iterations) << endl;
+    }
+  }
+  return delivered == 0;
+}
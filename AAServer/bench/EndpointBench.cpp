@@ -0,0 +1,107 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "AioEndpoint.h"
+#include "BlockingEndpoint.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Moves data through a bulk endpoint with the blocking transfers of
+// --aio-depth 0 and with AIO at several depths, driving them the way the
+// reactor does: keep the endpoint full, wait on its eventfd, take the
+// completions. Only a FunctionFS endpoint with a host on the other side
+// gives numbers that mean anything, e.g. ep1 while the host reads from it:
+//
+//   EndpointBench /dev/ffs-aa/ep1 write
+//   EndpointBench /dev/ffs-aa/ep2 read
+//
+// Without a path it writes to a temporary file, which only checks that the
+// benchmark runs.
+
+struct Result {
+  double mbPerSecond;
+  double transfersPerSecond;
+};
+
+static Result run(BulkEndpoint &endpoint, bool write, size_t transferSize,
+                  chrono::milliseconds duration) {
+  vector<vector<uint8_t>> buffers(endpoint.depth(),
+                                  vector<uint8_t>(transferSize, 0x5a));
+  size_t next = 0;
+  size_t bytes = 0, transfers = 0;
+  auto start = chrono::steady_clock::now();
+  auto end = start + duration;
+  while (true) {
+    bool submitting = chrono::steady_clock::now() < end;
+    if (!submitting && endpoint.inFlight() == 0)
+      break;
+    while (submitting && endpoint.inFlight() < endpoint.depth()) {
+      auto &buffer = buffers[next++ % buffers.size()];
+      if (write) {
+        struct iovec iov = {buffer.data(), buffer.size()};
+        endpoint.submitWrite(&iov, 1);
+      } else {
+        endpoint.submitRead(buffer.data(), buffer.size());
+      }
+    }
+    struct pollfd pfd = {endpoint.eventFd(), POLLIN, 0};
+    poll(&pfd, 1, -1);
+    ssize_t ret;
+    while (endpoint.takeCompleted(ret)) {
+      bytes += ret;
+      transfers++;
+    }
+  }
+  auto us = chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - start)
+                .count();
+  return {(double)bytes / us, transfers * 1e6 / us};
+}
+
+int main(int argc, char *argv[]) {
+  string path = argc > 1 ? argv[1] : "";
+  bool write = argc > 2 ? string(argv[2]) != "read" : true;
+  size_t transferSize = argc > 3 ? strtoul(argv[3], nullptr, 10) : 16384;
+  chrono::milliseconds duration(argc > 4 ? atoi(argv[4]) : 2000);
+  char tmpPath[] = "/tmp/EndpointBenchXXXXXX";
+  if (path.empty()) {
+    auto fd = mkstemp(tmpPath);
+    if (fd == -1)
+      throw runtime_error("mkstemp failed");
+    close(fd);
+    path = tmpPath;
+    write = true;
+  }
+  cout << (write ? "writing to " : "reading from ") << path << ", "
+       << transferSize << " bytes per transfer" << endl;
+  cout << "endpoint\tdepth\tMBps\ttransfersPerSecond" << endl;
+  for (size_t depth : {0, 1, 2, 4, 8}) {
+    int fd = open(path.c_str(), write ? O_WRONLY : O_RDONLY);
+    if (fd == -1)
+      throw runtime_error("cannot open " + path);
+    unique_ptr<BulkEndpoint> endpoint;
+    if (depth == 0)
+      endpoint = make_unique<BlockingEndpoint>(fd);
+    else
+      endpoint = make_unique<AioEndpoint>(fd, depth);
+    auto r = run(*endpoint, write, transferSize, duration);
+    endpoint.reset();
+    close(fd);
+    cout << (depth == 0 ? "blocking" : "aio") << "\t" << depth << "\t"
+         << fixed << setprecision(1) << r.mbPerSecond << "\t"
+         << setprecision(0) << r.transfersPerSecond << endl;
+  }
+  if (path == tmpPath)
+    unlink(tmpPath);
+}
@@ -0,0 +1,108 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Message.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// Cuts video sized messages into fragments the way the encrypting thread
+// does and counts the bytes the send queue copies on the way. The plaintext
+// every fragment hands to SSL_write is the same for both queues and is
+// reported separately.
+
+// send queue entry before the payload was shared: the pump took a copy of
+// the front entry for every fragment
+struct CopiedMessage {
+  uint8_t channel;
+  uint8_t flags;
+  vector<uint8_t> content;
+  size_t offset;
+};
+
+struct Result {
+  double bytesCopiedPerFrame;
+  double usPerFrame;
+};
+
+static uint8_t record[17 * 1024];
+static size_t plaintextBytes;
+
+// stands in for SSL_write, which reads the fragment once
+static void consume(const uint8_t *data, size_t size) {
+  memcpy(record, data, size);
+  plaintextBytes += size;
+}
+
+static Result copied(size_t messageSize, size_t fragmentSize, int frames) {
+  deque<CopiedMessage> queue;
+  size_t bytesCopied = 0;
+  auto start = chrono::steady_clock::now();
+  for (int f = 0; f < frames; ++f) {
+    queue.push_back({3, 0, vector<uint8_t>(messageSize, f), 0});
+    while (!queue.empty()) {
+      auto msg = queue.front();
+      bytesCopied += msg.content.size();
+      auto length = min(fragmentSize, msg.content.size() - msg.offset);
+      consume(msg.content.data() + msg.offset, length);
+      if (msg.offset + length == msg.content.size())
+        queue.pop_front();
+      else
+        queue.front().offset += length;
+    }
+  }
+  auto us = chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - start)
+                .count();
+  return {(double)bytesCopied / frames, (double)us / frames};
+}
+
+static Result shared(size_t messageSize, size_t fragmentSize, int frames) {
+  deque<OutgoingMessage> queue;
+  auto start = chrono::steady_clock::now();
+  for (int f = 0; f < frames; ++f) {
+    auto content = make_shared<ByteBuffer>(messageSize);
+    memset(content->data(), f, messageSize);
+    queue.emplace_back(3, 0, std::move(content));
+    while (!queue.empty()) {
+      auto &msg = queue.front();
+      auto length = min(fragmentSize, msg.payloadSize() - msg.offset);
+      consume(msg.payload() + msg.offset, length);
+      msg.offset += length;
+      if (msg.offset == msg.payloadSize())
+        queue.pop_front();
+    }
+  }
+  auto us = chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - start)
+                .count();
+  return {0, (double)us / frames};
+}
+
+int main(int argc, char *argv[]) {
+  int frames = argc > 1 ? atoi(argv[1]) : 200;
+  cout << "frames per run: " << frames << endl;
+  cout << "queue\tmessageSize\tfragmentSize\tbytesCopiedPerFrame"
+          "\tplaintextPerFrame\tusPerFrame"
+       << endl;
+  for (size_t messageSize : {10000, 100000, 300000}) {
+    for (size_t fragmentSize : {2000, 16384}) {
+      for (int variant = 0; variant < 2; ++variant) {
+        plaintextBytes = 0;
+        auto r = variant == 0 ? copied(messageSize, fragmentSize, frames)
+                              : shared(messageSize, fragmentSize, frames);
+        cout << (variant == 0 ? "copied" : "shared") << "\t" << messageSize
+             << "\t" << fragmentSize << "\t" << fixed << setprecision(0)
+             << r.bytesCopiedPerFrame << "\t" << plaintextBytes / frames
+             << "\t" << setprecision(1) << r.usPerFrame << endl;
+      }
+    }
+  }
+}
@@ -0,0 +1,89 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "TlsPair.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Sends a video sized message through TLS the way AaCommunicator frames it:
+// one SSL_write per fragment, the resulting record behind an AA frame
+// header, then decrypted by the receiving side. Shows how the fragment size
+// trades TLS and framing overhead against the size of a single transfer.
+
+struct Result {
+  double mbPerSecond;
+  double wireRatio;
+  size_t frames;
+};
+
+static Result run(Endpoint &sender, Endpoint &receiver,
+                  const vector<uint8_t> &payload, size_t fragmentSize,
+                  int iterations) {
+  vector<uint8_t> frame(8 + 17 * 1024 + 256);
+  vector<uint8_t> received(payload.size());
+  size_t wireBytes = 0;
+  size_t frames = 0;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    size_t receivedBytes = 0;
+    for (size_t offset = 0; offset < payload.size();
+         offset += fragmentSize) {
+      auto length = min(fragmentSize, payload.size() - offset);
+      if (SSL_write(sender.ssl, payload.data() + offset, length) !=
+          (int)length)
+        throw runtime_error("SSL_write failed");
+      // first fragment carries the total length as well
+      size_t header = offset == 0 ? 8 : 4;
+      auto record = BIO_read(sender.writeBio, frame.data() + header,
+                             frame.size() - header);
+      if (record <= 0)
+        throw runtime_error("BIO_read failed");
+      wireBytes += header + record;
+      frames++;
+      BIO_write(receiver.readBio, frame.data() + header, record);
+      auto n = SSL_read(receiver.ssl, received.data() + receivedBytes,
+                        received.size() - receivedBytes);
+      if (n != (int)length)
+        throw runtime_error("SSL_read failed");
+      receivedBytes += n;
+    }
+  }
+  auto us = chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - start)
+                .count();
+  Result r;
+  r.mbPerSecond = (double)payload.size() * iterations / us;
+  r.wireRatio = (double)wireBytes / (payload.size() * iterations);
+  r.frames = frames / iterations;
+  return r;
+}
+
+int main(int argc, char *argv[]) {
+  size_t messageSize = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  int iterations = argc > 2 ? atoi(argv[2]) : 200;
+  TlsPair tls;
+  auto &server = tls.server;
+  auto &client = tls.client;
+  cout << "cipher: " << SSL_get_cipher(server.ssl)
+       << ", message size: " << messageSize << endl;
+
+  vector<uint8_t> payload(messageSize);
+  for (size_t i = 0; i < payload.size(); ++i)
+    payload[i] = i * 31;
+  cout << "fragmentSize\tframes\tMBps\twireRatio" << endl;
+  for (size_t fragmentSize : {256, 512, 1024, 2048, 4096, 8192, 16384}) {
+    // warm up
+    run(server, client, payload, fragmentSize, 5);
+    auto r = run(server, client, payload, fragmentSize, iterations);
+    cout << fragmentSize << "\t" << r.frames << "\t" << fixed
+         << setprecision(1) << r.mbPerSecond << "\t" << setprecision(4)
+         << r.wireRatio << endl;
+  }
+}
@@ -0,0 +1,127 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Message.h"
+#include "MpscQueue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// the send queue before MpscQueue: every push takes the mutex and notifies,
+// the consumer waits on the condition variable
+template <typename T> class MutexQueue {
+  mutex m;
+  condition_variable cv;
+  deque<T> items;
+
+public:
+  explicit MutexQueue(size_t) {}
+  bool tryPush(T &value) {
+    {
+      unique_lock<mutex> lk(m);
+      items.push_back(std::move(value));
+    }
+    cv.notify_all();
+    return true;
+  }
+  optional<T> pop() {
+    unique_lock<mutex> lk(m);
+    if (items.empty())
+      return nullopt;
+    optional<T> value(std::move(items.front()));
+    items.pop_front();
+    return value;
+  }
+  void wait(int timeout) {
+    unique_lock<mutex> lk(m);
+    cv.wait_for(lk, chrono::milliseconds(timeout),
+                [this]() { return !items.empty(); });
+  }
+};
+
+struct Result {
+  double messagesPerSecond;
+  double pushNsAverage;
+  long pushNsMax;
+};
+
+// producers hand messages over as the channel handlers do, the consumer
+// only takes them out like the encrypting thread
+template <typename Queue> Result run(int producerCount, size_t perProducer) {
+  Queue queue(1024);
+  auto content = make_shared<const ByteBuffer>(1000);
+  atomic<int> ready{0};
+  atomic<bool> go{false};
+  atomic<long> pushNsTotal{0};
+  atomic<long> pushNsMax{0};
+  vector<thread> producers;
+  for (int p = 0; p < producerCount; ++p) {
+    producers.emplace_back([&]() {
+      long total = 0, maximum = 0;
+      ready++;
+      while (!go)
+        this_thread::yield();
+      for (size_t i = 0; i < perProducer; ++i) {
+        OutgoingMessage msg(1, 0, content);
+        auto start = chrono::steady_clock::now();
+        while (!queue.tryPush(msg))
+          this_thread::yield();
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(
+                      chrono::steady_clock::now() - start)
+                      .count();
+        total += ns;
+        maximum = std::max(maximum, (long)ns);
+      }
+      pushNsTotal += total;
+      long seen = pushNsMax;
+      while (maximum > seen && !pushNsMax.compare_exchange_weak(seen, maximum))
+        ;
+    });
+  }
+  while (ready < producerCount)
+    this_thread::yield();
+  auto start = chrono::steady_clock::now();
+  go = true;
+  size_t received = 0;
+  while (received < producerCount * perProducer) {
+    if (queue.pop())
+      received++;
+    else
+      queue.wait(1000);
+  }
+  auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start)
+                     .count();
+  for (auto &producer : producers)
+    producer.join();
+  return {received / seconds, (double)pushNsTotal / received, pushNsMax};
+}
+
+template <typename Queue>
+void report(const string &name, int producerCount, size_t perProducer) {
+  auto result = run<Queue>(producerCount, perProducer);
+  cout << name << "\t" << producerCount << "\t"
+       << (long)result.messagesPerSecond << "\t" << result.pushNsAverage
+       << "\t" << result.pushNsMax << endl;
+}
+
+int main(int argc, char *argv[]) {
+  size_t perProducer = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+  cout << "cores: " << thread::hardware_concurrency()
+       << ", messages per producer: " << perProducer << endl;
+  cout << "queue\tproducers\tmessages/s\tpushNsAvg\tpushNsMax" << endl;
+  for (int producers : {1, 2, 4, 8}) {
+    report<MutexQueue<OutgoingMessage>>("mutex+deque", producers, perProducer);
+    report<MpscQueue<OutgoingMessage>>("mpsc", producers, perProducer);
+  }
+  return 0;
+}
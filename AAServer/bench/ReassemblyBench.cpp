@@ -0,0 +1,150 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "BufferPool.h"
+#include "SharedBuffer.h"
+#include "Statistics.h"
+#include "TlsPair.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+// Receives fragmented messages from the headunit side of a TLS session and
+// counts the bytes copied per message besides the decrypt itself.
+//
+// copied: what AAClient's getMessage does and what AAServer did per frame:
+// the record is copied out of the transfer, decrypted into a stack buffer,
+// copied into a vector of its own and appended to the message.
+//
+// inPlace: what AaCommunicator::handleFrame does with Reassembly: a pooled
+// buffer is sized from the total length of the first fragment and every
+// record is decrypted straight into its free part.
+
+struct Frame {
+  vector<uint8_t> bytes;
+  size_t recordOffset;
+};
+
+// frames of one message as they arrive on ep2
+static vector<Frame> encrypt(Endpoint &sender, size_t messageSize,
+                             size_t fragmentSize) {
+  vector<uint8_t> payload(messageSize);
+  for (size_t i = 0; i < payload.size(); ++i)
+    payload[i] = i * 7;
+  vector<Frame> frames;
+  for (size_t offset = 0; offset < messageSize; offset += fragmentSize) {
+    auto length = min(fragmentSize, messageSize - offset);
+    SSL_write(sender.ssl, payload.data() + offset, length);
+    Frame frame;
+    frame.recordOffset = offset == 0 ? 8 : 4;
+    frame.bytes.resize(frame.recordOffset + BIO_pending(sender.writeBio));
+    BIO_read(sender.writeBio, frame.bytes.data() + frame.recordOffset,
+             frame.bytes.size() - frame.recordOffset);
+    frames.push_back(std::move(frame));
+  }
+  return frames;
+}
+
+static size_t bytesCopied;
+
+static shared_ptr<const vector<uint8_t>>
+receiveCopied(Endpoint &receiver, const vector<Frame> &frames) {
+  vector<uint8_t> message;
+  for (auto &frame : frames) {
+    vector<uint8_t> record(frame.bytes.begin() + frame.recordOffset,
+                           frame.bytes.end());
+    bytesCopied += record.size();
+    BIO_write(receiver.readBio, record.data(), record.size());
+    const int plainBufSize = 100 * 1024;
+    char plainBuf[plainBufSize];
+    auto ret = SSL_read(receiver.ssl, plainBuf, plainBufSize);
+    if (ret < 0)
+      throw runtime_error("SSL_read failed");
+    vector<uint8_t> plain(plainBuf, plainBuf + ret);
+    bytesCopied += ret;
+    message.insert(message.end(), plain.begin(), plain.end());
+    bytesCopied += ret;
+  }
+  return make_shared<const vector<uint8_t>>(std::move(message));
+}
+
+static SharedBuffer receiveInPlace(Endpoint &receiver, BufferPool &pool,
+                                   const vector<Frame> &frames,
+                                   size_t messageSize) {
+  auto buffer = pool.acquire(messageSize);
+  buffer->resize(messageSize);
+  size_t filled = 0;
+  for (auto &frame : frames) {
+    BIO_write(receiver.readBio, frame.bytes.data() + frame.recordOffset,
+              frame.bytes.size() - frame.recordOffset);
+    auto ret = SSL_read(receiver.ssl, buffer->data() + filled,
+                        buffer->size() - filled);
+    if (ret < 0)
+      throw runtime_error("SSL_read failed");
+    filled += ret;
+  }
+  buffer->resize(filled);
+  return buffer;
+}
+
+struct Result {
+  double bytesCopiedPerMessage;
+  double usPerMessage;
+};
+
+// records are decrypted in sequence, so every run encrypts its own frames
+template <typename Receive>
+Result run(TlsPair &tls, size_t messageSize, size_t fragmentSize,
+           int messages, Receive receive) {
+  vector<vector<Frame>> encrypted;
+  for (int i = 0; i < messages; ++i)
+    encrypted.push_back(encrypt(tls.client, messageSize, fragmentSize));
+  bytesCopied = 0;
+  auto start = chrono::steady_clock::now();
+  for (auto &frames : encrypted) {
+    auto message = receive(frames);
+    if (message->size() != messageSize)
+      throw runtime_error("message incomplete");
+  }
+  auto us = chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - start)
+                .count();
+  return {(double)bytesCopied / messages, (double)us / messages};
+}
+
+int main(int argc, char *argv[]) {
+  int messages = argc > 1 ? atoi(argv[1]) : 200;
+  TlsPair tls;
+  Counter misses;
+  BufferPool pool(misses);
+  cout << "messages per run: " << messages << endl;
+  cout << "receive\tmessageSize\tfragmentSize\tbytesCopiedPerMessage"
+          "\tusPerMessage"
+       << endl;
+  for (size_t messageSize : {1000, 20000, 100000}) {
+    for (size_t fragmentSize : {2000, 16384}) {
+      auto copied = run(tls, messageSize, fragmentSize, messages,
+                        [&](const vector<Frame> &frames) {
+                          return receiveCopied(tls.server, frames);
+                        });
+      auto inPlace = run(tls, messageSize, fragmentSize, messages,
+                         [&](const vector<Frame> &frames) {
+                           return receiveInPlace(tls.server, pool, frames,
+                                                 messageSize);
+                         });
+      for (auto r : {make_pair("copied", copied),
+                     make_pair("inPlace", inPlace)}) {
+        cout << r.first << "\t" << messageSize << "\t" << fragmentSize
+             << "\t" << fixed << setprecision(0)
+             << r.second.bytesCopiedPerMessage << "\t" << setprecision(1)
+             << r.second.usPerMessage << endl;
+      }
+    }
+  }
+}
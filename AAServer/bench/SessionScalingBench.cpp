@@ -0,0 +1,140 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "WorkerPool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Runs the channel handlers of several sessions the way main.cpp does, on
+// one WorkerPool, and counts handled messages per session. A handler waits
+// a fixed time as it does when it writes to a client socket or to a send
+// queue that is full, so the numbers show how many sessions the threads
+// keep going, not CPU speed.
+//
+// fixedPool: the pool has --handler-threads threads for all sessions
+// shares: the pool has --handler-threads threads per session and every
+// session may use that many of them
+//
+// With stalled set, the handlers of the first session never return, like
+// those of a headunit that stopped reading.
+
+static const size_t handlerThreads = 4;
+static const size_t channelsPerSession = 6;
+
+struct Session {
+  unique_ptr<PoolShare> share;
+  vector<unique_ptr<SerialExecutor>> channels;
+  atomic<size_t> handled{0};
+};
+
+class Gate {
+  mutex m;
+  condition_variable cv;
+  bool open = false;
+
+public:
+  void wait() {
+    unique_lock<mutex> lk(m);
+    cv.wait(lk, [this]() { return open; });
+  }
+  void release() {
+    {
+      unique_lock<mutex> lk(m);
+      open = true;
+    }
+    cv.notify_all();
+  }
+};
+
+// handled messages per second of every session
+static vector<double> run(bool shares, size_t sessionCount, bool stalled,
+                          chrono::microseconds handlerTime,
+                          chrono::milliseconds duration) {
+  WorkerPool pool(shares ? handlerThreads * sessionCount : handlerThreads);
+  vector<unique_ptr<Session>> sessions;
+  atomic<bool> stopping(false);
+  Gate gate;
+  for (size_t s = 0; s < sessionCount; ++s) {
+    auto session = make_unique<Session>();
+    if (shares)
+      session->share = make_unique<PoolShare>(handlerThreads);
+    for (size_t c = 0; c < channelsPerSession; ++c) {
+      session->channels.push_back(
+          make_unique<SerialExecutor>(pool, session->share.get()));
+    }
+    sessions.push_back(std::move(session));
+  }
+  // every channel always has a message waiting, a handled one is replaced
+  function<void(Session &, SerialExecutor &, bool)> post =
+      [&](Session &session, SerialExecutor &channel, bool stall) {
+        channel.post([&, stall]() {
+          if (stall) {
+            gate.wait();
+            return;
+          }
+          this_thread::sleep_for(handlerTime);
+          session.handled++;
+          if (!stopping)
+            post(session, channel, false);
+        });
+      };
+  auto start = chrono::steady_clock::now();
+  for (size_t s = 0; s < sessionCount; ++s) {
+    for (auto &channel : sessions[s]->channels)
+      post(*sessions[s], *channel, stalled && s == 0);
+  }
+  this_thread::sleep_for(duration);
+  vector<double> rates;
+  auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start)
+                     .count();
+  for (auto &session : sessions)
+    rates.push_back(session->handled / seconds);
+  stopping = true;
+  gate.release();
+  for (auto &session : sessions) {
+    for (auto &channel : session->channels)
+      channel->stop();
+  }
+  return rates;
+}
+
+int main(int argc, char *argv[]) {
+  chrono::microseconds handlerTime(argc > 1 ? atoi(argv[1]) : 1000);
+  chrono::milliseconds duration(argc > 2 ? atoi(argv[2]) : 1000);
+  cout << "handler time: " << handlerTime.count() << " us, "
+       << handlerThreads << " handler threads per session, "
+       << channelsPerSession << " busy channels per session" << endl;
+  cout << "pool\tstalled\tsessions\ttotalPerSecond\tworstSessionPerSecond"
+       << endl;
+  for (bool stalled : {false, true}) {
+    for (bool shares : {false, true}) {
+      for (size_t sessionCount : {1, 2, 4, 8}) {
+        if (stalled && sessionCount == 1)
+          continue;
+        auto rates =
+            run(shares, sessionCount, stalled, handlerTime, duration);
+        double total = 0, worst = -1;
+        // the stalled session itself is not counted
+        for (size_t s = stalled ? 1 : 0; s < rates.size(); ++s) {
+          total += rates[s];
+          if (worst < 0 || rates[s] < worst)
+            worst = rates[s];
+        }
+        cout << (shares ? "shares" : "fixedPool") << "\t"
+             << (stalled ? "yes" : "no") << "\t" << sessionCount << "\t"
+             << fixed << setprecision(0) << total << "\t" << worst << endl;
+      }
+    }
+  }
+}
@@ -0,0 +1,81 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <cstdio>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <stdexcept>
+#pragma once
+
+// One side of a TLS session whose records are passed around in memory
+struct Endpoint {
+  SSL *ssl;
+  BIO *readBio;
+  BIO *writeBio;
+};
+
+// Server with the certificate AAServer uses and a client, connected over
+// memory BIOs. Like AaCommunicator it stays on TLS 1.2.
+class TlsPair {
+  SSL_CTX *serverCtx;
+  SSL_CTX *clientCtx;
+
+  static Endpoint makeEndpoint(SSL_CTX *ctx) {
+    Endpoint e;
+    e.ssl = SSL_new(ctx);
+    e.readBio = BIO_new(BIO_s_mem());
+    e.writeBio = BIO_new(BIO_s_mem());
+    SSL_set_bio(e.ssl, e.readBio, e.writeBio);
+    return e;
+  }
+
+  // moves everything one side wrote to the other side
+  static void transfer(Endpoint &from, Endpoint &to) {
+    char buf[16384];
+    int n;
+    while ((n = BIO_read(from.writeBio, buf, sizeof(buf))) > 0)
+      BIO_write(to.readBio, buf, n);
+  }
+
+  void handshake() {
+    SSL_set_accept_state(server.ssl);
+    SSL_set_connect_state(client.ssl);
+    for (int round = 0; round < 10; ++round) {
+      auto c = SSL_do_handshake(client.ssl);
+      transfer(client, server);
+      auto s = SSL_do_handshake(server.ssl);
+      transfer(server, client);
+      if (c == 1 && s == 1)
+        return;
+    }
+    throw std::runtime_error("handshake failed");
+  }
+
+public:
+  Endpoint server;
+  Endpoint client;
+
+  TlsPair() {
+    serverCtx = SSL_CTX_new(TLS_server_method());
+    clientCtx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_max_proto_version(serverCtx, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(clientCtx, TLS1_2_VERSION);
+    if (SSL_CTX_use_certificate_file(serverCtx, CERT_DIR "/android_auto.crt",
+                                     SSL_FILETYPE_PEM) <= 0 ||
+        SSL_CTX_use_PrivateKey_file(serverCtx, CERT_DIR "/android_auto.key",
+                                    SSL_FILETYPE_PEM) <= 0) {
+      ERR_print_errors_fp(stderr);
+      throw std::runtime_error("cannot load " CERT_DIR "/android_auto.*");
+    }
+    server = makeEndpoint(serverCtx);
+    client = makeEndpoint(clientCtx);
+    handshake();
+  }
+  TlsPair(const TlsPair &) = delete;
+  TlsPair &operator=(const TlsPair &) = delete;
+  ~TlsPair() {
+    SSL_free(server.ssl);
+    SSL_free(client.ssl);
+    SSL_CTX_free(serverCtx);
+    SSL_CTX_free(clientCtx);
+  }
+};
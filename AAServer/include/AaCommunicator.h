@@ -1,12 +1,25 @@
 // Distributed under GPLv3 only as specified in repository's root LICENSE file
 
+#include "AccessoryGadget.h"
+#include "BulkEndpoint.h"
 #include "ChannelHandler.h"
 #include "ChannelType.h"
-#include "Function.h"
-#include "Gadget.h"
+#include "Delegate.h"
+#include "CommunicatorOptions.h"
+#include "FragmentSizeController.h"
 #include "Message.h"
+#include "MpscQueue.h"
+#include "PhaseTimer.h"
+#include "Reactor.h"
+#include "Reassembly.h"
+#include "SendScheduler.h"
+#include "SpscRing.h"
+#include "Statistics.h"
+#include "WorkerPool.h"
 #include "enums.h"
+#include <atomic>
 #include <boost/signals2.hpp>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <deque>
@@ -15,62 +28,196 @@
 #include <mutex>
 #include <openssl/ossl_typ.h>
 #include <pcap/pcap.h>
+#include <string>
 #include <thread>
 #include <vector>
 #pragma once
 
 class AaCommunicator {
-  const Library &lib;
-  std::unique_ptr<Gadget> mainGadget;
-  std::unique_ptr<Function> ffs_function;
-  int ep0fd = -1, ep1fd = -1, ep2fd = -1;
+  AccessoryGadget &gadget;
+  Reactor &reactor;
+  const CommunicatorOptions options;
+  boost::signals2::scoped_connection ep0Connection;
+  std::chrono::steady_clock::time_point sessionStart;
+  // connection phases up to the first video frame written to ep1, reported
+  // once per session
+  PhaseTimer connectTimer;
+  std::atomic<bool> connectReported{false};
+  // owned by the dispatching thread
+  int sslRounds = 0;
+  void reportConnectTiming();
 
-  std::mutex sendQueueMutex;
-  std::deque<Message> sendQueue;
-  std::condition_variable sendQueueNotEmpty;
+  // handoff from the channel handlers to the encrypting thread
+  MpscQueue<OutgoingMessage> sendQueue;
+  // owned by the encrypting thread, filled from sendQueue
+  SendScheduler scheduler;
+  // a frame ready to be written: encrypted frames are built in buffer, plain
+  // messages that were framed in their headroom are only referenced
+  struct ReadyFrame {
+    ByteBuffer buffer;
+    SharedBuffer message;
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    // last frame of the first video media message
+    bool firstVideoFrame = false;
+    // may be the frame that probes the larger fragment size
+    bool probe = false;
+    // video sample the frame belongs to, 0 for other messages
+    uint64_t sampleId = 0;
+  };
+  // frames that are already encrypted and framed, in TLS record order; kept
+  // short so that the scheduler decides as late as possible
+  SpscRing<ReadyFrame> readyFrames;
+  FragmentSizeController fragmentSize;
+  SendBudget budget;
+  // owned by the encrypting thread
+  bool firstVideoFrameQueued = false;
+  // set after a reference frame was dropped, later non-keyframes of the
+  // channel would reference it; a keyframe is requested from the source
+  std::atomic<bool> waitingForKeyframe[UINT8_MAX + 1];
+  // written by the channel's producer
+  std::chrono::steady_clock::time_point keyframeLost[UINT8_MAX + 1];
 
-  std::mutex threadsMutex;
-  bool threadFinished = false;
-  std::vector<std::thread> threads;
+  Statistics statistics;
+  Counter &messagesSent;
+  Counter &framesSent;
+  Counter &payloadBytesSent;
+  Counter &payloadBytesCopied;
+  Counter &fragmentSizeGauge;
+  Counter &sendQueuePushNs;
+  Counter &sendQueuePushMaxNs;
+  Counter &sendQueueFullWaits;
+  Counter &queuedBytes;
+  Counter &ep1Syscalls;
+  Counter &ep1Transfers;
+  Counter &ep1Bytes;
+  Counter &ep1FramesPerTransferMax;
+  Counter &ep2Transfers;
+  Counter &ep2Bytes;
+  Counter *sendDelayUs[PriorityCount];
+  Counter *sendDelayMessages[PriorityCount];
+  Counter *droppedMessages[PriorityCount];
+  Counter *droppedBytes[PriorityCount];
+  Counter *blockedUs[PriorityCount];
+  Counter &framesReceived;
+  Counter &messagesReceived;
+  Counter &payloadBytesReceived;
+  Counter &payloadBytesReceivedCopied;
+  // receive buffers the pool could not recycle; this is not every allocation
+  // on the receive path, posting a message to its channel executor still
+  // allocates the task
+  Counter &receiveBufferPoolMisses;
+
+  Counter &readerStallUs;
+  Counter &decryptBusyUs;
+  Counter &dispatchBusyUs;
+  Counter &receivedTransfersDepth;
+  Counter &receivedMessagesDepth;
+  Counter &firstVideoFrameMs;
+  Counter &nonReferenceDrops;
+  Counter &referenceDrops;
+  Counter &dependentDrops;
+  Counter &recoveries;
+  Counter &recoveryUs;
+  Counter &recoveryMaxUs;
+  Counter &suspends;
+  Counter &suspendedMs;
+
+  // driven by ep0 events, owned by the reactor thread; nothing is written
+  // while suspended and the channels idle
+  enum PowerState { Disabled, Active, Suspended };
+  PowerState powerState = Disabled;
+  std::chrono::steady_clock::time_point suspendStart;
+  void setPowerState(PowerState state);
 
-  struct ThreadDescriptor {
-    int fd;
-    std::function<ssize_t(int, void *, size_t)> readFun;
-    std::function<ssize_t(int, const void *, size_t)> writeFun;
-    std::function<void(const std::exception &ex)> endFun;
-    std::function<bool()> checkTerminate;
+  // receive pipeline: the reader only drains ep2 so that the headunit is
+  // not NAKed while a handler is slow, frames are decrypted and reassembled
+  // on the next thread and complete messages are handled on the last one
+  struct ReceivedTransfer {
+    std::vector<uint8_t> buffer;
+    size_t size = 0;
   };
+  SpscRing<ReceivedTransfer> receivedTransfers;
+  SpscRing<Message> receivedMessages;
+  // owned by the decrypting thread
+  BufferPool receiveBuffers;
+  Reassembly reassembly[UINT8_MAX + 1];
+
+  // bulk endpoints, driven from the reactor thread
+  std::unique_ptr<BulkEndpoint> ep1Io, ep2Io;
+  std::unique_ptr<BulkEndpoint> openEndpoint(int fd);
+  // ready frames covered by each write in flight, oldest first
+  std::deque<size_t> framesPerWrite;
+  size_t framesInFlight = 0;
+  // set by a side that ran out of work and waits for the other one, whoever
+  // clears it has to resume the waiting side
+  std::atomic<bool> resumeReads{false};
+  std::atomic<bool> resumeWrites{false};
+  std::atomic<bool> resumeEncrypt{false};
+  bool readerStalled = false;
+  std::chrono::steady_clock::time_point readerStallStart;
+
+  std::mutex threadsMutex;
+  std::atomic<bool> threadFinished{false};
+  std::vector<std::thread> threads;
 
-  void sendMessage(uint8_t channel, uint8_t flags,
-                   const std::vector<uint8_t> &buf);
+  // false if msg was dropped by the overload policy or the session ends
+  bool sendMessage(OutgoingMessage msg);
   void sendVersionResponse(__u16 major, __u16 minor);
   void handlePingRequest(const void *buf, size_t nbytes);
+  void sendPingRequest();
   void handleVersionRequest(const void *buf, size_t nbytes);
   void handleSslHandshake(const void *buf, size_t nbytes);
   void sendServiceDiscoveryRequest();
   void handleServiceDiscoveryResponse(const void *buf, size_t nbytes);
   void handleMessageContent(const Message &message);
-  ssize_t handleMessage(int fd, const void *buf, size_t nbytes);
-  std::vector<uint8_t> decryptMessage(const std::vector<uint8_t> &encryptedMsg);
-  ssize_t getMessage(int fd, void *buf, size_t nbytes);
-  ssize_t handleEp0Message(int fd, const void *buf, size_t nbytes);
+  size_t handleFrame(const uint8_t *buf, size_t nbytes);
+  void submitReads();
+  void readsCompleted();
+  void decryptPump();
+  void dispatchPump();
+  size_t decryptMessage(const uint8_t *encrypted, size_t size, uint8_t *plain,
+                        size_t capacity);
+  void classifyMessage(OutgoingMessage &msg, OverloadPolicy policy);
+  void dropMessage(const OutgoingMessage &msg);
+  void queueForSending(OutgoingMessage &&msg);
+  void drainSendQueue();
+  void prepareFrame(OutgoingMessage &msg, ReadyFrame &frame);
+  void encryptPump();
+  void submitWrites();
+  void writesCompleted();
+  void handleEp0Event(const usb_functionfs_event &event);
+  void startTransfers();
+  void runGuarded(const std::function<void()> &fun);
+  void unregisterEndpoints();
   void threadTerminated(const std::exception &ex);
-  static ssize_t readWraper(int fd, void *buf, size_t nbytes);
-  static void dataPump(ThreadDescriptor *threadDescriptor);
-  void startThread(int fd, std::function<ssize_t(int, void *, size_t)> readFun,
-                   std::function<ssize_t(int, const void *, size_t)> writeFun);
+  void startThread(std::function<void()> threadFun);
 
   // SSL related
   void initializeSsl();
   void initializeSslContext();
   static int verifyCertificate(int preverify_ok, X509_STORE_CTX *x509_ctx);
   SSL_CTX *ctx = nullptr;
+  // SSL objects are not thread safe, encryption and decryption run on
+  // different threads
+  std::mutex sslMutex;
   SSL *ssl = nullptr;
   BIO *readBio = nullptr;
   BIO *writeBio = nullptr;
 
   ChannelHandler *channelHandlers[UINT8_MAX + 1];
   uint8_t channelTypeToChannelNumber[ChannelType::MaxValue];
+  // handlers may block, each channel gets its messages in order on its own
+  // executor so that other channels keep going
+  WorkerPool &handlerPool;
+  PoolShare *handlerShare;
+  std::unique_ptr<SerialExecutor> channelExecutors[UINT8_MAX + 1];
+  // guards publishing channelHandlers, the reactor thread tells them about
+  // suspend with the reactor mutex held; nothing that takes the reactor
+  // mutex may run while it is held
+  std::mutex channelsMutex;
+  SerialExecutor &channelExecutor(uint8_t channel);
+  void postChannelMessage(const Message &message);
   void handleChannelMessage(const Message &message);
 
   std::mutex m;
@@ -79,20 +226,29 @@ class AaCommunicator {
 
   pcap_t *pd = nullptr;
   pcap_dumper_t *pdumper = nullptr;
-  void logMessage(const Message &msg, bool direction);
+  void logMessage(uint8_t channel, uint8_t flags, const uint8_t *content,
+                  size_t size, bool direction);
 
 public:
-  AaCommunicator(const Library &_lib, const std::string &dumpfile);
-  void setup(const Udc &udc);
+  // handlerPool may be shared with other sessions, handlerShare limits the
+  // threads this session's handlers take from it
+  AaCommunicator(AccessoryGadget &gadget, Reactor &reactor,
+                 WorkerPool &handlerPool, PoolShare *handlerShare,
+                 const CommunicatorOptions &options, const std::string &name);
+  // starts the session on the gadget, transfers begin once the headunit
+  // enabled it
+  void start();
   boost::signals2::signal<void(const std::exception &ex)> error;
-  boost::signals2::signal<void(int clientId, uint8_t channelNumber,
-                               bool specific, std::vector<uint8_t> data)>
+  Delegate<void(int clientId, uint8_t channelNumber, bool specific,
+                const SharedBuffer &data)>
       gotMessage;
   uint8_t getChannelNumberByChannelType(ChannelType ct);
   void sendToChannel(int clientId, uint8_t channelNumber, bool specific,
-                     const std::vector<uint8_t> &data);
+                     const SharedBuffer &data);
   void disconnected(int clientId);
   std::vector<uint8_t> getServiceDescriptor();
+  void reportStatistics(std::ostream &ostr);
+  void setFragmentSize(size_t size);
 
   ~AaCommunicator();
 };
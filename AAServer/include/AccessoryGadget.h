@@ -0,0 +1,39 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Function.h"
+#include "Gadget.h"
+#include "Library.h"
+#include "Reactor.h"
+#include "Udc.h"
+#include <boost/signals2.hpp>
+#include <linux/usb/functionfs.h>
+#include <memory>
+#pragma once
+
+// The accessory mode gadget and its FunctionFS endpoints. It outlives the
+// sessions, a headunit that reconnects finds the same gadget. ep0 is read
+// on the reactor thread all the time, its events are passed on from there.
+// Every UDC served gets its own gadget.
+class AccessoryGadget {
+  const Library &lib;
+  Reactor &reactor;
+  int udcId;
+  std::unique_ptr<Gadget> mainGadget;
+  std::unique_ptr<Function> ffs_function;
+  int ep0fd = -1, ep1fd = -1, ep2fd = -1;
+  // reactor thread only
+  bool enabled = false;
+  void ep0Readable();
+
+public:
+  AccessoryGadget(const Library &lib, Reactor &reactor, int udcId);
+  ~AccessoryGadget();
+  void enable(const Udc &udc);
+  // bulk IN (to the headunit) and bulk OUT endpoints
+  int ep1() const { return ep1fd; }
+  int ep2() const { return ep2fd; }
+  // reactor thread only; true between FUNCTIONFS_ENABLE and
+  // FUNCTIONFS_DISABLE, only then bulk transfers can be submitted
+  bool isEnabled() const { return enabled; }
+  boost::signals2::signal<void(const usb_functionfs_event &event)> ep0Event;
+};
@@ -0,0 +1,37 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "BulkEndpoint.h"
+#include <cstddef>
+#include <linux/aio_abi.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+#pragma once
+
+// Keeps several transfers in flight on a FunctionFS endpoint using Linux
+// native AIO, so that the USB controller always has a request queued.
+class AioEndpoint : public BulkEndpoint {
+  int fd;
+  int efd = -1;
+  aio_context_t ctx = 0;
+  size_t maxInFlight;
+  std::vector<struct iocb> iocbs;
+  std::vector<std::vector<struct iovec>> iovs;
+  std::vector<long long> results;
+  std::vector<bool> done;
+  size_t submitted = 0;
+  size_t completed = 0;
+
+  void submit(struct iocb &cb);
+  void reap();
+
+public:
+  AioEndpoint(int fd, size_t depth);
+  ~AioEndpoint();
+  size_t depth() const override { return maxInFlight; }
+  size_t inFlight() const override { return submitted - completed; }
+  void submitRead(void *buffer, size_t size) override;
+  void submitWrite(const struct iovec *iov, int count) override;
+  int eventFd() const override { return efd; }
+  bool takeCompleted(ssize_t &result) override;
+};
@@ -0,0 +1,56 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "BulkEndpoint.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <thread>
+#include <vector>
+#pragma once
+
+// For UDC drivers whose AIO support is broken: one blocking read or write at
+// a time, done by a thread of its own that reports the completion on an
+// eventfd like AioEndpoint does. The worker polls the endpoint together with
+// a stop eventfd before every transfer, so the destructor wakes it without
+// signals. FunctionFS endpoints do not implement poll and always look ready
+// though; a transfer already started on one ends only when the host
+// completes it or the function gets disabled.
+class BlockingEndpoint : public BulkEndpoint {
+  int fd;
+  int efd = -1;
+  // readable once the endpoint goes away
+  int stopFd = -1;
+  std::mutex m;
+  std::condition_variable cv;
+  // guarded by m
+  bool stopping = false;
+  bool pending = false;
+  // the submitted transfer, written before pending is set
+  bool isWrite = false;
+  void *readBuffer = nullptr;
+  size_t readSize = 0;
+  std::vector<struct iovec> iov;
+  // written by the worker before it signals the eventfd
+  std::atomic<bool> done{false};
+  ssize_t result = 0;
+  int error = 0;
+  // owned by the reactor thread, a transfer was submitted and not taken
+  bool busy = false;
+  std::thread worker;
+
+  void run();
+  void submit();
+
+public:
+  explicit BlockingEndpoint(int fd);
+  ~BlockingEndpoint();
+  size_t depth() const override { return 1; }
+  size_t inFlight() const override { return busy ? 1 : 0; }
+  void submitRead(void *buffer, size_t size) override;
+  void submitWrite(const struct iovec *iov, int count) override;
+  int eventFd() const override { return efd; }
+  bool takeCompleted(ssize_t &result) override;
+};
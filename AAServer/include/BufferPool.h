@@ -0,0 +1,33 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "SharedBuffer.h"
+#include "Statistics.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#pragma once
+
+// Recycles receive buffers. Buffers are grouped in power of 2 size classes
+// and keep their capacity, a buffer is free again once the pool holds the
+// only reference to it, so handlers may keep a message as long as they like.
+// acquire() may only be called from one thread, references can be dropped
+// anywhere.
+class BufferPool {
+  static constexpr size_t minClassShift = 10;
+  static constexpr size_t classCount = 11;
+  // buffers kept per class, more are allocated but not recycled
+  static constexpr size_t maxPooled = 16;
+  std::vector<std::shared_ptr<ByteBuffer>> classes[classCount];
+  Counter &allocations;
+
+public:
+  // larger messages are rare and get a buffer of their own
+  static constexpr size_t maxPooledSize = (size_t)1
+                                          << (minClassShift + classCount - 1);
+
+  explicit BufferPool(Counter &allocations);
+  // returns an empty buffer with at least the requested capacity, growing it
+  // within that capacity neither allocates nor clears memory
+  std::shared_ptr<ByteBuffer> acquire(size_t size);
+};
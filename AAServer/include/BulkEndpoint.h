@@ -0,0 +1,26 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+#pragma once
+
+// Transfers on a FunctionFS bulk endpoint, driven from the reactor thread.
+// FunctionFS data endpoints cannot be polled, so completions are signalled
+// on an eventfd and handed out in submission order. Buffers passed to
+// submit* have to stay valid until their completion was returned by
+// takeCompleted.
+class BulkEndpoint {
+public:
+  virtual ~BulkEndpoint() = default;
+  // transfers that may be in flight at the same time
+  virtual size_t depth() const = 0;
+  virtual size_t inFlight() const = 0;
+  virtual void submitRead(void *buffer, size_t size) = 0;
+  virtual void submitWrite(const struct iovec *iov, int count) = 0;
+  // readable when transfers completed
+  virtual int eventFd() const = 0;
+  // never blocks; returns false while the oldest transfer is still in
+  // flight, otherwise stores the number of bytes it transferred in result
+  virtual bool takeCompleted(ssize_t &result) = 0;
+};
@@ -2,35 +2,41 @@
 
 #pragma once
 
+#include "ChannelSetup.h"
+#include "Delegate.h"
 #include "Message.h"
-#include <boost/signals2.hpp>
-#include <condition_variable>
-#include <mutex>
+#include <string>
 #include <vector>
 
 class ChannelHandler {
-  bool gotChannelOpenResponse;
   void sendChannelOpenRequest();
-  void expectChannelOpenResponse();
-  std::mutex m;
-  std::condition_variable cv;
 
 protected:
   uint8_t channelId;
-  void openChannel();
+  // first step of every channel setup
+  ChannelSetup::Step channelOpenStep();
 
 public:
   ChannelHandler(uint8_t channelId);
   virtual void disconnected(int clientId);
+  // the USB link to the headunit was suspended or resumed
+  virtual void setSuspended(bool suspended);
+  // asks the source of the channel for a frame that decodes on its own,
+  // after a frame others depend on was dropped; any thread
+  virtual void requestKeyframe();
+  // a message that sendToHeadunit accepted was dropped before it was
+  // written; called on the encrypting thread, must not block
+  virtual void messageDropped(const OutgoingMessage &message);
   virtual bool handleMessageFromHeadunit(const Message &message) = 0;
   virtual bool handleMessageFromClient(int clientId, uint8_t channelId, bool specific,
-                                       const std::vector<uint8_t> &data) = 0;
-  boost::signals2::signal<void(int clientId, uint8_t channelNumber, bool specific,
-                               std::vector<uint8_t> data)>
+                                       const SharedBuffer &data) = 0;
+  Delegate<void(int clientId, uint8_t channelNumber, bool specific,
+                const SharedBuffer &data)>
       sendToClient;
-  boost::signals2::signal<void(uint8_t channelNumber, uint8_t flags,
-                               std::vector<uint8_t> data)>
-      sendToHeadunit;
+  // false if the message was dropped instead of being queued
+  Delegate<bool(OutgoingMessage message)> sendToHeadunit;
+  // milestones of the channel setup, for the connection timing
+  Delegate<void(const std::string &phase)> phaseReached;
 
   virtual ~ChannelHandler();
 };
@@ -0,0 +1,58 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Delegate.h"
+#include "Reactor.h"
+#include "Timer.h"
+#include "WorkerPool.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#pragma once
+
+// Request/response exchanges that bring a channel up (ChannelOpen, media
+// Setup, input Handshake), run one after another without blocking anyone.
+// A request whose response does not arrive in time is sent again, after
+// maxAttempts the setup fails. Timeouts are handled on the channel's
+// executor, so they are ordered with the responses.
+class ChannelSetup {
+public:
+  enum State { Idle, Running, Done, Failed };
+  struct Step {
+    std::string name;
+    uint16_t responseType;
+    std::function<void()> sendRequest;
+  };
+  static constexpr std::chrono::milliseconds timeout{1000};
+  static const int maxAttempts = 5;
+
+  ChannelSetup(Reactor &reactor, SerialExecutor &executor, uint8_t channelId,
+               std::vector<Step> steps,
+               std::function<void(bool succeeded)> finished);
+  // starts from the first step, does nothing while a setup is running
+  void start();
+  // starts unless the setup is running or done already
+  void ensureStarted();
+  // true if messageType is the response the running step waits for
+  bool handleResponse(uint16_t messageType);
+  State state();
+  // name of each step that got its response, in order
+  Delegate<void(const std::string &step)> stepCompleted;
+
+private:
+  SerialExecutor &executor;
+  uint8_t channelId;
+  std::vector<Step> steps;
+  std::function<void(bool succeeded)> finished;
+  std::mutex m;
+  State currentState = Idle;
+  size_t step = 0;
+  int attempts = 0;
+  std::chrono::steady_clock::time_point deadline;
+  Timer timer;
+  void timedOut();
+  // called with m held, returns what has to be called once it is released
+  std::function<void()> sendCurrentStep();
+};
@@ -0,0 +1,35 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "SendBudget.h"
+#include "SendScheduler.h"
+#include <cstddef>
+#include <string>
+#pragma once
+
+class CommunicatorOptions {
+public:
+  // pcap file all messages are logged to, empty disables logging
+  std::string dumpfile;
+  // upper bound of bytes written to ep1 in a single call when several frames
+  // are ready; 0 writes every frame on its own
+  size_t maxTransferSize = 0;
+  // plaintext bytes per AA frame the session is switched to after service
+  // discovery, kept only if the headunit still responds
+  size_t fragmentSize = 2000;
+  // plaintext bytes per AA frame during session setup and after a failed probe
+  size_t fallbackFragmentSize = 2000;
+  // bytes allowed to wait for sending on a single channel and on all of them
+  size_t channelBudget = 4 << 20;
+  size_t totalBudget = 16 << 20;
+  // what happens to a message of given priority class that does not fit
+  OverloadPolicy overloadPolicies[PriorityCount] = {
+      BlockPolicy, BlockPolicy, BlockPolicy, DropNonKeyframePolicy};
+  // threads running channel handlers of all sessions, each channel is
+  // handled serially
+  size_t handlerThreads = 4;
+  // transfers kept in flight on ep1 and ep2 with native AIO; 0 does one
+  // blocking transfer at a time on a thread per endpoint instead
+  size_t aioDepth = 2;
+  // shmsink socket the video is read from, one mixer per headunit
+  std::string videoSocketPath = "/tmp/aacs_mixer";
+};
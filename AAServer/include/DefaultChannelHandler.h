@@ -11,6 +11,6 @@ public:
   virtual bool handleMessageFromHeadunit(const Message &message);
   virtual bool handleMessageFromClient(int clientId, uint8_t channelId,
                                        bool specific,
-                                       const std::vector<uint8_t> &data);
+                                       const SharedBuffer &data);
   virtual ~DefaultChannelHandler();
 };
@@ -0,0 +1,59 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+#pragma once
+
+template <typename Signature> class Delegate;
+
+// Callback list for hot paths. Emitting takes no lock and allocates nothing:
+// it calls the slots of an immutable list published through an atomic
+// pointer. connect copies the list, lists that were replaced stay alive
+// until the delegate is destroyed because an emit may still walk them.
+// Slots cannot be disconnected, they live as long as the delegate. A
+// delegate with a result returns what the last slot returned, or R() if
+// nothing is connected.
+template <typename R, typename... Args> class Delegate<R(Args...)> {
+  typedef std::vector<std::function<R(Args...)>> SlotList;
+  std::atomic<const SlotList *> slots{nullptr};
+  std::mutex m;
+  std::vector<std::unique_ptr<const SlotList>> lists;
+
+public:
+  Delegate() = default;
+  Delegate(const Delegate &) = delete;
+  Delegate &operator=(const Delegate &) = delete;
+
+  void connect(std::function<R(Args...)> slot) {
+    std::unique_lock<std::mutex> lk(m);
+    auto list = std::make_unique<SlotList>();
+    if (auto current = slots.load())
+      *list = *current;
+    list->push_back(std::move(slot));
+    slots.store(list.get(), std::memory_order_release);
+    lists.push_back(std::move(list));
+  }
+
+  bool empty() const { return slots.load() == nullptr; }
+
+  template <typename... CallArgs> R operator()(CallArgs &&... args) const {
+    auto list = slots.load(std::memory_order_acquire);
+    if constexpr (std::is_void_v<R>) {
+      if (!list)
+        return;
+      for (const auto &slot : *list)
+        slot(args...);
+    } else {
+      R result{};
+      if (!list)
+        return result;
+      for (const auto &slot : *list)
+        result = slot(args...);
+      return result;
+    }
+  }
+};
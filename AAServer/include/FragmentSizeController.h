@@ -0,0 +1,48 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#pragma once
+
+// Chooses how much plaintext goes into one AA frame. A session starts with
+// the fallback size, which is known to work everywhere, and switches to the
+// target size once the service discovery is done. The first frame of any
+// message that is larger than the fallback is the probe. The larger size stays
+// if the headunit answers the ping sent after the probe or acks the probe's
+// video sample, otherwise we go back to the fallback size for the rest of the
+// session.
+class FragmentSizeController {
+  std::mutex m;
+  size_t fallback;
+  size_t target;
+  size_t current;
+  bool probing = false;
+  bool probeSent = false;
+  // video sample the probe belonged to, 0 for other messages
+  uint64_t probeSample = 0;
+  std::chrono::steady_clock::time_point probeWriteTime;
+  std::chrono::milliseconds probeTimeout;
+  static size_t clamp(size_t size);
+
+public:
+  // AA frame length is 16 bit and one frame has to hold a single TLS record
+  static constexpr size_t minSize = 256;
+  static constexpr size_t maxSize = 16384;
+
+  FragmentSizeController(size_t fallback, size_t target,
+                         std::chrono::milliseconds probeTimeout);
+  size_t get();
+  void set(size_t size);
+  void sessionReady();
+  // whether a fragment may be the one the probe waits for
+  bool isProbe(size_t size);
+  // the fragment went out on the bus, the timeout starts now; false if
+  // another one was written first
+  bool probeWritten(uint64_t sampleId);
+  // the headunit acked the samples up to sampleId
+  void sampleAcked(uint64_t sampleId);
+  // the headunit answered a ping sent after the probe
+  void pingAnswered();
+};
@@ -17,4 +17,6 @@ public:
                   const std::string &serialNumber);
   usbg_gadget *getGadget() const;
   void enable(const Udc &udc);
+  // unbinds the gadget from its UDC, the configfs tree is kept
+  void disable();
 };
@@ -0,0 +1,28 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <cstddef>
+#include <cstdint>
+#pragma once
+
+enum H264NalType {
+  NonIdrSlice = 1,
+  IdrSlice = 5,
+  Sei = 6,
+  Sps = 7,
+  Pps = 8,
+  AccessUnitDelimiter = 9,
+};
+
+// What an encoded frame means for dropping it
+struct H264AccessUnit {
+  // decodable on its own
+  bool idr = false;
+  // later frames may be predicted from it (nal_ref_idc of its first slice),
+  // dropping it breaks them up to the next IDR
+  bool reference = false;
+  // carries SPS or PPS
+  bool parameterSets = false;
+};
+
+// looks at the NAL units of an Annex B access unit up to its first slice
+H264AccessUnit h264Parse(const uint8_t *data, size_t size);
@@ -0,0 +1,29 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Configuration.h"
+#include "Function.h"
+#include "Gadget.h"
+#include "Library.h"
+#include "ServerUtils.h"
+#include "Udc.h"
+#include <memory>
+#pragma once
+
+// The gadget a headunit sees before it asked for accessory mode: a mass
+// storage LUN and a FunctionFS function whose ep0 gets the AOA requests.
+// Like AccessoryGadget it is set up once per UDC and kept, so the mode
+// switch only has to bind it.
+class InitialGadget {
+  std::unique_ptr<Gadget> gadget;
+  std::unique_ptr<Function> ms_function;
+  std::unique_ptr<Function> ffs_function;
+  std::unique_ptr<Configuration> configuration;
+  // closed before the FunctionFS instance is unmounted
+  UniqueFd ep0fd;
+
+public:
+  InitialGadget(const Library &lib, int udcId);
+  void enable(const Udc &udc);
+  void disable();
+  int ep0() const { return ep0fd.get(); }
+};
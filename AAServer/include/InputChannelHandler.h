@@ -3,22 +3,31 @@
 #pragma once
 
 #include "ChannelHandler.h"
+#include "ChannelSetup.h"
+#include <mutex>
+#include <set>
 #include <vector>
 
 class InputChannelHandler : public ChannelHandler {
+  // client messages kept while the channel is being set up
+  static const size_t maxPendingMessages = 16;
   void sendHandshakeRequest();
-  void expectHandshakeResponse();
-  bool gotHandshakeResponse;
+  void setupFinished(bool succeeded);
+  // guards the fields below; client messages are sent with it held so that
+  // pending ones go out first
   std::mutex m;
-  std::condition_variable cv;
   std::set<int> registered_clients;
+  bool channelReady = false;
+  std::vector<OutgoingMessage> pendingMessages;
   std::vector<int> available_buttons;
+  ChannelSetup setup;
 
 public:
-  InputChannelHandler(uint8_t channelId, std::vector<int> available_buttons);
+  InputChannelHandler(uint8_t channelId, std::vector<int> available_buttons,
+                      Reactor &reactor, SerialExecutor &executor);
   virtual void disconnected(int clientId) override;
   virtual bool handleMessageFromHeadunit(const Message &message) override;
   virtual bool handleMessageFromClient(int clientId, uint8_t channelId, bool specific,
-                          const std::vector<uint8_t> &data) override;
+                          const SharedBuffer &data) override;
   virtual ~InputChannelHandler();
 };
@@ -1,5 +1,6 @@
 // Distributed under GPLv3 only as specified in repository's root LICENSE file
 
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #pragma once
@@ -8,7 +9,9 @@ class ManualResetEvent {
 public:
   ManualResetEvent();
   void set();
+  void reset();
   void wait();
+  bool waitFor(std::chrono::milliseconds timeout);
 
 private:
   std::mutex m;
@@ -1,7 +1,10 @@
 // Distributed under GPLv3 only as specified in repository's root LICENSE file
 
+#include "SharedBuffer.h"
 #include "enums.h"
+#include <chrono>
 #include <cstdint>
+#include <memory>
 #include <sys/stat.h>
 #include <vector>
 #pragma once
@@ -11,6 +14,35 @@ public:
   Message();
   uint8_t channel;
   uint8_t flags;
-  std::vector<uint8_t> content;
-  int offset;
+  SharedBuffer content;
+};
+
+// Entry of the send queue. The payload is shared and never modified once
+// queued, the pump only advances offset while cutting it into frames.
+// Content may start with headroom bytes reserved for the frame header, for
+// plain messages built by MessageBuilder the header is already in there.
+class OutgoingMessage {
+public:
+  OutgoingMessage(uint8_t channel, uint8_t flags, SharedBuffer content,
+                  size_t headroom = 0);
+  uint8_t channel;
+  uint8_t flags;
+  SharedBuffer content;
+  size_t headroom;
+  size_t offset;
+  std::chrono::steady_clock::time_point enqueued;
+  // media payloads may be dropped by the overload policy of their channel
+  bool droppable;
+  bool keyframe;
+  // later frames depend on it, see H264AccessUnit
+  bool reference;
+  // sent beyond the receiver's window, the overload policy treats it like
+  // a message over the channel budget
+  bool congested;
+  // set by handlers that count their messages in flight, so that they get
+  // the credit back if it is dropped after it was accepted; 0 otherwise
+  uint64_t sampleId;
+
+  const uint8_t *payload() const { return content->data() + headroom; }
+  size_t payloadSize() const { return content->size() - headroom; }
 };
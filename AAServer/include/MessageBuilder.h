@@ -0,0 +1,32 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Message.h"
+#include <cstddef>
+#include <cstdint>
+#include <google/protobuf/message_lite.h>
+#include <vector>
+#pragma once
+
+// Builds an outgoing message in a single allocation. Room for the frame
+// header (channel, flags, length, total length) is reserved in front of the
+// payload, so plain messages are framed in place and the buffer is handed
+// over to the send queue as is.
+class MessageBuilder {
+  uint8_t channel;
+  uint8_t flags;
+  ByteBuffer buffer;
+
+public:
+  static constexpr size_t headroom = 8;
+
+  // payloadSize is the expected number of bytes following the message type
+  MessageBuilder(uint8_t channel, uint8_t flags, uint16_t messageType,
+                 size_t payloadSize = 0);
+  MessageBuilder(uint8_t channel, uint8_t flags, uint16_t messageType,
+                 const google::protobuf::MessageLite &payload);
+  void pushBackInt16(uint16_t num);
+  void pushBackInt64(uint64_t num);
+  void append(const void *data, size_t size);
+  void append(const google::protobuf::MessageLite &payload);
+  OutgoingMessage build();
+};
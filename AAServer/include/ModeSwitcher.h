@@ -1,13 +1,25 @@
 // Distributed under GPLv3 only as specified in repository's root LICENSE file
 
+#include <string>
 #include <sys/types.h>
 #pragma once
 
+class AccessoryGadget;
+class InitialGadget;
 class Library;
+class PhaseTimer;
 
 class ModeSwitcher {
-  static ssize_t handleSwitchMessage(int fd, const void *buf, size_t nbytes);
+  // every AOA request is marked on timer
+  static ssize_t handleSwitchMessage(int fd, const void *buf, size_t nbytes,
+                                     PhaseTimer &timer);
 
 public:
-  static void handleSwitchToAccessoryMode(const Library &lib);
+  // both gadgets have to be set up already, accessory is bound to the UDC
+  // in place of initial as soon as the headunit asks for accessory mode;
+  // returns false without switching once cancelFd becomes readable
+  static bool handleSwitchToAccessoryMode(const Library &lib,
+                                          InitialGadget &initial,
+                                          AccessoryGadget &accessory,
+                                          int udcId, int cancelFd);
 };
@@ -0,0 +1,111 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+#pragma once
+
+// Bounded lock-free multi producer/single consumer queue (sequence numbered
+// cells as in Vyukov's bounded queue). The consumer sleeps on an eventfd which
+// producers only signal when the consumer announced that it is going to sleep,
+// so the common case costs no syscall.
+template <typename T> class MpscQueue {
+  struct Cell {
+    std::atomic<size_t> sequence;
+    std::optional<T> data;
+  };
+  std::vector<Cell> cells;
+  size_t mask;
+  alignas(64) std::atomic<size_t> enqueuePos{0};
+  alignas(64) size_t dequeuePos = 0;
+  alignas(64) std::atomic<bool> sleeping{false};
+  int efd;
+
+public:
+  explicit MpscQueue(size_t capacity) : cells(capacity), mask(capacity - 1) {
+    if (capacity < 2 || (capacity & mask) != 0)
+      throw std::invalid_argument("MpscQueue capacity must be a power of 2");
+    for (size_t i = 0; i < capacity; ++i)
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd == -1)
+      throw std::runtime_error("eventfd failed");
+  }
+  ~MpscQueue() { close(efd); }
+
+  // any thread; value is only moved from when true is returned
+  bool tryPush(T &value) {
+    auto pos = enqueuePos.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+      cell = &cells[pos & mask];
+      auto seq = cell->sequence.load(std::memory_order_acquire);
+      auto diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data.emplace(std::move(value));
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.exchange(false))
+      wake();
+    return true;
+  }
+
+  // consumer thread only
+  std::optional<T> pop() {
+    auto &cell = cells[dequeuePos & mask];
+    auto seq = cell.sequence.load(std::memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(dequeuePos + 1) < 0)
+      return std::nullopt;
+    std::optional<T> value(std::move(cell.data));
+    cell.data.reset();
+    cell.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+    dequeuePos++;
+    return value;
+  }
+
+  bool empty() const {
+    auto &cell = cells[dequeuePos & mask];
+    return (intptr_t)cell.sequence.load(std::memory_order_acquire) -
+               (intptr_t)(dequeuePos + 1) <
+           0;
+  }
+
+  // consumer thread only; returns early when something was pushed or wake()
+  // was called, timeout is in milliseconds, -1 waits forever
+  void wait(int timeout) {
+    sleeping.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (empty()) {
+      struct pollfd pfd = {efd, POLLIN, 0};
+      poll(&pfd, 1, timeout);
+    }
+    sleeping.store(false);
+    uint64_t value;
+    while (read(efd, &value, sizeof(value)) > 0) {
+    }
+  }
+
+  void wake() {
+    uint64_t one = 1;
+    while (write(efd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+  }
+
+  int eventFd() const { return efd; }
+};
@@ -3,6 +3,7 @@
 #pragma once
 #include "ChannelType.h"
 #include "PacketType.h"
+#include "SharedBuffer.h"
 #include <vector>
 #include <cstdint>
 
@@ -11,5 +12,5 @@ public:
   PacketType packetType;
   uint8_t channelNumber;
   uint8_t specific;
-  std::vector<uint8_t> data;
+  SharedBuffer data;
 };
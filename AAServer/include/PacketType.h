@@ -4,4 +4,8 @@ enum PacketType {
   GetChannelNumberByChannelType,
   RawData,
   GetServiceDescriptor,
+  SetFragmentSize,
+  // channelNumber is the id of the UDC whose headunit the client talks to;
+  // clients that do not send it get the first UDC served
+  SelectSession,
 };
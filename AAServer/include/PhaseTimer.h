@@ -0,0 +1,32 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#pragma once
+
+// Durations of consecutive steps, each mark() ends the step that ran since
+// the previous one. Marks may come from any thread, the offset from the start
+// is kept as well because steps of different channels overlap.
+class PhaseTimer {
+  struct Phase {
+    std::string name;
+    int64_t us;
+    int64_t atUs;
+  };
+  std::string name;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point last;
+  mutable std::mutex m;
+  std::vector<Phase> phases;
+
+public:
+  explicit PhaseTimer(const std::string &name);
+  void mark(const std::string &phase);
+  // one JSON line: {"name":..., "phases":[{"phase":..., "ms":..., "atMs":...},
+  // ...], "totalMs":...}
+  void report(std::ostream &ostr) const;
+};
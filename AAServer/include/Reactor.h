@@ -0,0 +1,48 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#pragma once
+
+// epoll loop running on its own thread. It owns the file descriptors that
+// are waited for: FunctionFS ep0, eventfds signalling transfer completions on
+// the bulk endpoints, the client listener and the client sockets. Nothing is
+// polled with a timeout, so an idle session does not wake up at all.
+// Handlers run on the reactor thread and must not block.
+class Reactor {
+  int epfd = -1;
+  int wakeFd = -1;
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+  // held while a handler runs, so that remove() from another thread returns
+  // only when the handler of the fd is not running any more
+  std::recursive_mutex m;
+  std::map<int, std::function<void(uint32_t events)>> handlers;
+  // handlers removed while running, destroyed once they returned
+  std::vector<std::function<void(uint32_t events)>> removed;
+  std::mutex postedMutex;
+  std::vector<std::function<void()>> posted;
+  bool stopped = false;
+  void run();
+  void wake();
+
+public:
+  Reactor();
+  ~Reactor();
+  void add(int fd, uint32_t events,
+           std::function<void(uint32_t events)> handler);
+  void modify(int fd, uint32_t events);
+  void remove(int fd);
+  // runs fun on the reactor thread
+  void post(std::function<void()> fun);
+  // runs fun on the reactor thread after everything posted before and waits
+  // for it; once the reactor stopped fun runs on the calling thread
+  void call(std::function<void()> fun);
+  // stops the loop and waits for the reactor thread
+  void stop();
+};
@@ -0,0 +1,32 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "BufferPool.h"
+#include "SharedBuffer.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#pragma once
+
+// Collects the fragments of the message that is currently being received on
+// one channel. The buffer is taken from the pool once for the total length
+// announced by the first fragment and every fragment is decrypted straight
+// into the free part of it.
+class Reassembly {
+  std::shared_ptr<ByteBuffer> buffer;
+  size_t filled = 0;
+  uint8_t flags = 0;
+  bool active = false;
+
+public:
+  // upper bound for the total length a headunit may announce
+  static constexpr size_t maxMessageSize = 16 << 20;
+
+  void start(BufferPool &pool, uint8_t flags, size_t size);
+  bool inProgress() const { return active; }
+  uint8_t messageFlags() const { return flags; }
+  uint8_t *freeSpace() { return buffer->data() + filled; }
+  size_t freeSize() const { return buffer->size() - filled; }
+  void commit(size_t size);
+  SharedBuffer finish();
+};
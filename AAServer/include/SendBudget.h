@@ -0,0 +1,46 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#pragma once
+
+enum OverloadPolicy { BlockPolicy, DropOldestPolicy, DropNonKeyframePolicy };
+
+// Bytes waiting to be sent, per channel and in total. Bytes are added when a
+// message is accepted by sendMessage and released when its last fragment has
+// been encrypted or when it is dropped.
+class SendBudget {
+  size_t channelLimit;
+  size_t totalLimit;
+  std::atomic<size_t> channelBytes[UINT8_MAX + 1];
+  std::atomic<size_t> totalBytes{0};
+  std::atomic<int> waiters{0};
+  std::mutex m;
+  std::condition_variable cv;
+  // guarded by m
+  bool suspended = false;
+  bool stopped = false;
+
+public:
+  SendBudget(size_t channelLimit, size_t totalLimit);
+  // true if size more bytes would not fit; a channel with nothing queued
+  // always fits so that a single large message cannot block forever
+  bool exceeded(uint8_t channel, size_t size) const;
+  // bytes that have to be freed on the channel to be within budget again
+  size_t excess(uint8_t channel) const;
+  // waits until size bytes fit and returns true; returns false at once
+  // while suspended or stopped, nothing is sent then
+  bool waitForSpace(uint8_t channel, size_t size);
+  // waiters give up while the USB link is suspended, they block the
+  // executor that would tell their handler about it
+  void setSuspended(bool suspend);
+  // the session ends, waiters give up for good
+  void stop();
+  void add(uint8_t channel, size_t size);
+  void release(uint8_t channel, size_t size);
+  size_t queued() const;
+};
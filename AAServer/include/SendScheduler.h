@@ -0,0 +1,42 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Message.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#pragma once
+
+enum SendPriority { ControlPriority, InputPriority, AudioPriority,
+                    VideoPriority, PriorityCount };
+
+// Decides which fragment goes to the headunit next. Every channel has its own
+// FIFO, channels are served by priority class and round robin within a class,
+// one fragment at a time. Fragments of one message are never interleaved with
+// another message of the same channel, so First/middle/Last framing stays
+// valid. Only the encrypting thread touches the queues; priorities may be set
+// from any thread.
+class SendScheduler {
+  std::deque<OutgoingMessage> queues[UINT8_MAX + 1];
+  std::atomic<uint8_t> priorities[UINT8_MAX + 1];
+  std::deque<uint8_t> readyChannels[PriorityCount];
+  int currentPriority = -1;
+  size_t queuedMessages = 0;
+
+public:
+  SendScheduler();
+  void setPriority(uint8_t channel, SendPriority priority);
+  SendPriority getPriority(uint8_t channel) const;
+  void push(OutgoingMessage &&msg);
+  bool empty() const;
+  size_t size() const;
+  // message whose next fragment should be sent
+  OutgoingMessage &front();
+  // to be called after a fragment of front() has been cut
+  void fragmentSent();
+  // drops droppable messages of the channel which have not been started,
+  // oldest first, until at least bytes are freed; the newest keep messages
+  // are never dropped
+  void drop(uint8_t channel, size_t bytes, size_t keep,
+            const std::function<void(const OutgoingMessage &)> &dropped);
+};
@@ -2,4 +2,35 @@
 
 #pragma once
 
+#include <string>
+#include <unistd.h>
+
 void checkUsbgError(int returnValue);
+// name of a per UDC resource (gadget, mountpoint, socket); UDC 0 keeps the
+// plain name, so a single headunit setup is unchanged
+std::string udcInstanceName(const std::string &name, int udcId);
+
+// owns a file descriptor and closes it when it goes out of scope
+class UniqueFd {
+  int fd;
+
+public:
+  explicit UniqueFd(int _fd = -1) : fd(_fd) {}
+  UniqueFd(const UniqueFd &) = delete;
+  UniqueFd &operator=(const UniqueFd &) = delete;
+  UniqueFd &operator=(UniqueFd &&other) {
+    if (this != &other) {
+      reset();
+      fd = other.fd;
+      other.fd = -1;
+    }
+    return *this;
+  }
+  ~UniqueFd() { reset(); }
+  int get() const { return fd; }
+  void reset() {
+    if (fd != -1)
+      close(fd);
+    fd = -1;
+  }
+};
@@ -0,0 +1,9 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "ByteBuffer.h"
+#include <memory>
+#pragma once
+
+// Payload that is never modified after it was created. It is passed by
+// reference count, so handing a message to several receivers copies nothing.
+typedef std::shared_ptr<const ByteBuffer> SharedBuffer;
@@ -1,21 +1,46 @@
 // Distributed under GPLv3 only as specified in repository's root LICENSE file
 
 #pragma once
+#include "Delegate.h"
 #include "Packet.h"
+#include "Reactor.h"
+#include "WorkerPool.h"
+#include <atomic>
 #include <boost/signals2.hpp>
-#include <thread>
+#include <cstddef>
+#include <vector>
 
+// Client socket read on the reactor thread. Packets are handled in order on
+// an executor of the client pool because handlers may block.
 class SocketClient {
-  void clientThreadMethod();
-  std::thread clientThread;
-  bool clientThreadCancel = false;
+  // reading stops while this many packets wait for their handler
+  static const size_t maxPending = 64;
+  Reactor &reactor;
+  SerialExecutor executor;
   int fd;
+  std::vector<uint8_t> buffer;
+  std::atomic<size_t> pending{0};
+  std::atomic<bool> closed{false};
+  // set when a handler threw, later packets are dropped
+  std::atomic<bool> failed{false};
+  // reactor thread only
+  bool paused = false;
+  void readable();
+  void handlePacket(const Packet &p);
+  void resume();
 
 public:
-  SocketClient(int fd);
+  SocketClient(Reactor &reactor, WorkerPool &pool, int fd);
   ~SocketClient();
-  boost::signals2::signal<void(const Packet &p)> gotPacket;
+  Delegate<void(const Packet &p)> gotPacket;
   boost::signals2::signal<void()> disconnected;
   void sendMessage(const std::vector<uint8_t>& msg);
+  // header and payload go out in one write, payload is not copied
+  void sendMessage(const std::vector<uint8_t> &header,
+                   const ByteBuffer &payload);
   void ready();
+  // limits the client pool threads its packet handlers may take
+  void setShare(PoolShare *share) { executor.setShare(share); }
+  // the client sees the socket closed, disconnected follows
+  void disconnect();
 };
@@ -1,24 +1,31 @@
 // Distributed under GPLv3 only as specified in repository's root LICENSE file
 
 #pragma once
+#include "Reactor.h"
 #include "SocketClient.h"
+#include "WorkerPool.h"
 #include <boost/signals2.hpp>
 #include <cstddef>
+#include <functional>
 #include <mutex>
 #include <string>
-#include <thread>
 #include <set>
 
 class SocketCommunicator {
-  void listenThreadMethod();
-  std::thread listenThread;
-  bool listenThreadCancel = false;
+  void acceptClient();
+  Reactor &reactor;
+  // runs the packet handlers of all clients
+  WorkerPool clientPool;
+  std::mutex clientsMutex;
   std::set<SocketClient *> clients;
   std::string path;
   int sock;
 
 public:
-  SocketCommunicator(std::string path);
+  SocketCommunicator(Reactor &reactor, std::string path,
+                     size_t clientThreads = 2);
   ~SocketCommunicator();
+  // used when the session they were talking to is gone
+  void disconnectClients(std::function<bool(SocketClient *)> filter);
   boost::signals2::signal<void(SocketClient *ex)> newClient;
 };
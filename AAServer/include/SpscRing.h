@@ -0,0 +1,107 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#pragma once
+
+// Bounded single producer/single consumer ring. Slots are constructed once and
+// reused, so the producer fills them in place and buffers keep their capacity.
+// Indices are lock-free, the mutex is only taken by a side that has to sleep
+// and by the other side when it sees a sleeper.
+template <typename T> class SpscRing {
+  std::vector<T> slots;
+  size_t mask;
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+  std::atomic<int> sleepers{0};
+  std::atomic<bool> cancelled{false};
+  std::mutex m;
+  std::condition_variable cv;
+
+  void wake() {
+    if (sleepers.load() > 0) {
+      std::unique_lock<std::mutex> lk(m);
+      cv.notify_all();
+    }
+  }
+
+  template <typename Predicate>
+  bool sleep(std::chrono::milliseconds timeout, Predicate predicate) {
+    sleepers.fetch_add(1);
+    bool ret;
+    {
+      std::unique_lock<std::mutex> lk(m);
+      ret = cv.wait_for(lk, timeout, [&] { return cancelled || predicate(); });
+    }
+    sleepers.fetch_sub(1);
+    return ret;
+  }
+
+  template <typename Predicate> void sleep(Predicate predicate) {
+    sleepers.fetch_add(1);
+    {
+      std::unique_lock<std::mutex> lk(m);
+      cv.wait(lk, [&] { return cancelled || predicate(); });
+    }
+    sleepers.fetch_sub(1);
+  }
+
+public:
+  explicit SpscRing(size_t capacity) : slots(capacity), mask(capacity - 1) {
+    if (capacity == 0 || (capacity & mask) != 0)
+      throw std::invalid_argument("SpscRing capacity must be a power of 2");
+  }
+
+  size_t capacity() const { return slots.size(); }
+  size_t size() const { return tail.load() - head.load(); }
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() == slots.size(); }
+
+  // makes every wait return at once from now on, used on shutdown
+  void cancel() {
+    cancelled = true;
+    std::unique_lock<std::mutex> lk(m);
+    cv.notify_all();
+  }
+
+  // producer side
+  T *producerSlot(size_t index = 0) {
+    auto t = tail.load(std::memory_order_relaxed);
+    if (t + index - head.load(std::memory_order_acquire) >= slots.size())
+      return nullptr;
+    return &slots[(t + index) & mask];
+  }
+  void publish(size_t count = 1) {
+    tail.store(tail.load(std::memory_order_relaxed) + count);
+    wake();
+  }
+  bool waitNotFull(std::chrono::milliseconds timeout) {
+    return sleep(timeout, [this] { return !full(); });
+  }
+  void waitNotFull() {
+    sleep([this] { return !full(); });
+  }
+
+  // consumer side
+  T *consumerSlot(size_t index = 0) {
+    auto h = head.load(std::memory_order_relaxed);
+    if (tail.load(std::memory_order_acquire) - h <= index)
+      return nullptr;
+    return &slots[(h + index) & mask];
+  }
+  void pop(size_t count = 1) {
+    head.store(head.load(std::memory_order_relaxed) + count);
+    wake();
+  }
+  bool waitNotEmpty(std::chrono::milliseconds timeout) {
+    return sleep(timeout, [this] { return !empty(); });
+  }
+  void waitNotEmpty() {
+    sleep([this] { return !empty(); });
+  }
+};
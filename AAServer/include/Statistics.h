@@ -0,0 +1,47 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#pragma once
+
+class Counter {
+  std::atomic<uint64_t> value{0};
+
+public:
+  void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+  void sub(uint64_t n = 1) { value.fetch_sub(n, std::memory_order_relaxed); }
+  void set(uint64_t n) { value.store(n, std::memory_order_relaxed); }
+  void max(uint64_t n) {
+    auto current = value.load(std::memory_order_relaxed);
+    while (current < n && !value.compare_exchange_weak(
+                              current, n, std::memory_order_relaxed)) {
+    }
+  }
+  uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// Named counters of a session. Counters are created once and then updated
+// without locking, report() prints all of them as a single JSON line together
+// with per second rates of monotonic counters.
+class Statistics {
+  struct Entry {
+    Counter counter;
+    bool monotonic;
+    uint64_t lastValue = 0;
+  };
+  std::mutex m;
+  std::map<std::string, Entry> entries;
+  std::chrono::steady_clock::time_point lastReport;
+  Counter &get(const std::string &name, bool monotonic);
+
+public:
+  Statistics();
+  Counter &counter(const std::string &name);
+  Counter &gauge(const std::string &name);
+  void report(std::ostream &ostr);
+};
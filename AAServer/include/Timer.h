@@ -0,0 +1,23 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Reactor.h"
+#include <chrono>
+#include <functional>
+#pragma once
+
+// One-shot timer backed by a timerfd registered with the reactor. expired
+// runs on the reactor thread, so it must not block.
+class Timer {
+  Reactor &reactor;
+  int fd;
+  std::function<void()> expired;
+
+public:
+  Timer(Reactor &reactor, std::function<void()> expired);
+  Timer(const Timer &) = delete;
+  Timer &operator=(const Timer &) = delete;
+  ~Timer();
+  // (re)arms the timer, an earlier expiry that was not handled yet is lost
+  void start(std::chrono::milliseconds timeout);
+  void cancel();
+};
@@ -3,29 +3,97 @@
 #pragma once
 
 #include "ChannelHandler.h"
+#include "ChannelSetup.h"
+#include "H264.h"
+#include "SendBudget.h"
+#include "Statistics.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <gst/gst.h>
+#include <mutex>
+#include <string>
 
 class VideoChannelHandler : public ChannelHandler {
-  bool gotSetupResponse;
-  std::mutex m;
-  std::condition_variable cv;
-  bool channelOpened;
+  // samples kept while the channel is being set up, about a second
+  static const size_t maxPendingSamples = 30;
+  std::atomic<bool> channelOpened;
+  ChannelSetup setup;
+  // guards the fields below; samples are sent with it held so that pending
+  // ones go out first
+  std::mutex sampleMutex;
+  bool streaming = false;
+  // samples that arrived before the channel was ready, starting with a
+  // keyframe; others could not be decoded and are dropped
+  std::deque<OutgoingMessage> pendingSamples;
+  bool sampleSent = false;
+  uint64_t lastSampleId = 0;
+  // credit window: samples accepted by the send path but not acked yet, at
+  // most maxUnacked as given in the setup response (0 until then, which
+  // does not limit). Guarded by creditMutex, which is taken after
+  // sampleMutex and never held while sending; the encrypting thread returns
+  // the credit of samples it drops.
+  struct SentSample {
+    uint64_t id;
+    std::chrono::steady_clock::time_point sent;
+  };
+  std::mutex creditMutex;
+  OverloadPolicy windowPolicy;
+  uint32_t maxUnacked = 0;
+  std::deque<SentSample> unacked;
+  std::condition_variable creditAvailable;
+  // nobody reads while the USB link is suspended, the pipeline is paused
+  bool suspended = false;
+  bool stopping = false;
+  Counter &maxUnackedGauge;
+  Counter &inFlight;
+  Counter &inFlightMax;
+  Counter &acks;
+  Counter &ackRttUs;
+  Counter &ackRttMaxUs;
+  Counter &windowOverruns;
+  Counter &windowWaitUs;
+  Counter &keyframeRequests;
 
   void sendSetupRequest();
-  void expectSetupResponse();
   void sendStartIndication();
+  void setupFinished(bool succeeded);
+  // samples are only classified here, dropping them and waiting for the
+  // next keyframe is up to the overload policy on the send path
+  void handleSample(OutgoingMessage msg, const H264AccessUnit &au);
+  void sendSample(OutgoingMessage msg);
+  void releaseCredit(uint64_t sampleId);
+  // called with creditMutex held
+  bool hasCredit() const;
+  // with BlockPolicy waits for an ack, the streaming thread is held and the
+  // encoder idles; otherwise false is returned at once and the sample is
+  // sent as congested
+  bool waitForCredit();
+  void handleSetupResponse(const uint8_t *buf, size_t nbytes);
+  void handleAck(const uint8_t *buf, size_t nbytes);
 
   GstElement *pipeline;
+  GstElement *appSink;
 
   static GstFlowReturn new_sample(GstElement *sink, VideoChannelHandler *_this);
-  void openChannel();
 
 public:
-  VideoChannelHandler(uint8_t channelId);
+  VideoChannelHandler(uint8_t channelId, const std::string &socketPath,
+                      OverloadPolicy windowPolicy, Statistics &statistics,
+                      Reactor &reactor, SerialExecutor &executor);
   virtual void disconnected(int clientId);
+  virtual void setSuspended(bool suspended);
+  virtual void requestKeyframe();
+  virtual void messageDropped(const OutgoingMessage &message);
   virtual bool handleMessageFromHeadunit(const Message &message);
   virtual bool handleMessageFromClient(int clientId, uint8_t channelId,
                                        bool specific,
-                                       const std::vector<uint8_t> &data);
+                                       const SharedBuffer &data);
   virtual ~VideoChannelHandler();
+  // the first sample of the session went to the headunit
+  Delegate<void()> firstSampleSent;
+  // the headunit acked the samples up to the given id; called on the channel
+  // executor without any lock held
+  Delegate<void(uint64_t sampleId)> sampleAcked;
 };
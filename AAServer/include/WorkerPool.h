@@ -0,0 +1,74 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#pragma once
+
+class SerialExecutor;
+
+// Part of a pool's threads that a group of executors, e.g. those of one
+// session, may use at the same time. Tasks of a group that blocks keep at
+// most that many threads, the rest stay free for the other groups.
+class PoolShare {
+  friend class WorkerPool;
+  size_t limit;
+  // guarded by the pool's mutex
+  size_t running = 0;
+
+public:
+  explicit PoolShare(size_t _limit) : limit(_limit) {}
+};
+
+// Small set of threads running the tasks of serial executors. An executor
+// with pending tasks is queued once and runs a single task per turn, so busy
+// executors take turns. Executors whose share is used up wait in the queue
+// and are passed by the others.
+class WorkerPool {
+  std::mutex m;
+  std::condition_variable cv;
+  std::deque<SerialExecutor *> ready;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+  void run();
+
+public:
+  explicit WorkerPool(size_t threadCount);
+  void schedule(SerialExecutor *executor);
+  // moves an executor to another share, takes effect from its next task
+  void setShare(SerialExecutor *executor, PoolShare *share);
+  // waits for running tasks, pending ones are discarded
+  void stop();
+  ~WorkerPool();
+};
+
+// Runs posted tasks one after another in posting order, on whichever pool
+// thread is free.
+class SerialExecutor {
+  friend class WorkerPool;
+  WorkerPool &pool;
+  // guarded by the pool's mutex
+  PoolShare *share;
+  std::mutex m;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> tasks;
+  bool scheduled = false;
+  bool stopped = false;
+
+public:
+  // without a share the executor may use every thread of the pool
+  explicit SerialExecutor(WorkerPool &pool, PoolShare *share = nullptr);
+  // ignored once the executor stopped
+  void post(std::function<void()> task);
+  void setShare(PoolShare *share) { pool.setShare(this, share); }
+  // discards pending tasks and waits for the running one, so that a pool
+  // shared by several owners can be left; the pool has to be running and
+  // it must not be called from a task of this executor
+  void stop();
+  // called by the pool
+  void runOne();
+};
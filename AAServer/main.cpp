@@ -1,38 +1,136 @@
 // Distributed under GPLv3 only as specified in repository's root LICENSE file
 
 #include "AaCommunicator.h"
+#include "AccessoryGadget.h"
 #include "ChannelType.h"
+#include "InitialGadget.h"
 #include "Library.h"
 #include "ManualResetEvent.h"
 #include "ModeSwitcher.h"
 #include "Packet.h"
 #include "PacketType.h"
+#include "PhaseTimer.h"
+#include "Reactor.h"
+#include "ServerUtils.h"
 #include "SocketCommunicator.h"
 #include "Udc.h"
+#include "WorkerPool.h"
 #include "utils.h"
+#include <atomic>
 #include <boost/program_options.hpp>
 #include <csignal>
+#include <fmt/core.h>
 #include <gst/gst.h>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
 #include <stdexcept>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 using namespace std;
 using namespace boost::program_options;
 
 string configFsBasePath = "/sys/kernel/config";
 ManualResetEvent mre;
+atomic<bool> quitting(false);
+// readable once quitting, for threads waiting in poll
+int quitFd = -1;
+
+// threads a client's packet handlers may take from the client pool
+const size_t clientThreadsPerPort = 2;
+
+// a UDC and the sessions with the headunit connected to it; handlers and
+// client packets may block on a stalled headunit, so each port only gets
+// its share of the shared pools and the other ports keep going
+struct HeadunitPort {
+  int udcId;
+  InitialGadget initialGadget;
+  AccessoryGadget gadget;
+  PoolShare handlerShare;
+  PoolShare clientShare;
+  ManualResetEvent sessionEnded;
+  // client packets use the session under a shared lock, it is replaced
+  // under an exclusive one
+  shared_mutex sessionMutex;
+  unique_ptr<AaCommunicator> session;
+
+  HeadunitPort(const Library &lib, Reactor &reactor, int _udcId,
+               size_t handlerThreads)
+      : udcId(_udcId), initialGadget(lib, udcId),
+        gadget(lib, reactor, udcId),
+        handlerShare(handlerThreads), clientShare(clientThreadsPerPort) {}
+};
+
+struct ClientInfo {
+  int id;
+  int udcId;
+};
 
 void signal_handler(int signal) {
   cout << "Quitting..." << endl;
+  quitting = true;
+  uint64_t one = 1;
+  [[maybe_unused]] auto ret = write(quitFd, &one, sizeof(one));
   mre.set();
   std::signal(SIGINT, SIG_DFL);
 }
 
+void parseOverloadPolicy(CommunicatorOptions &options, const string &str) {
+  const map<string, SendPriority> classes = {{"control", ControlPriority},
+                                             {"input", InputPriority},
+                                             {"audio", AudioPriority},
+                                             {"video", VideoPriority}};
+  const map<string, OverloadPolicy> policies = {
+      {"block", BlockPolicy},
+      {"drop-oldest", DropOldestPolicy},
+      {"drop-non-keyframe", DropNonKeyframePolicy}};
+  auto pos = str.find('=');
+  if (pos == string::npos || !classes.count(str.substr(0, pos)) ||
+      !policies.count(str.substr(pos + 1)))
+    throw runtime_error("invalid overload policy: " + str);
+  options.overloadPolicies[classes.at(str.substr(0, pos))] =
+      policies.at(str.substr(pos + 1));
+}
+
 int main(int argc, char *argv[]) {
   options_description desc("Allowed options");
   desc.add_options()("help", "produce help message")(
-      "dumpfile", value<string>(), "specify pcap dumpfile for communication");
+      "verbose", "print every message received from the headunit")(
+      "dumpfile", value<string>(), "specify pcap dumpfile for communication")(
+      "ep1-transfer-size", value<size_t>()->default_value(0),
+      "pack ready frames into ep1 writes of up to given size in bytes (0 "
+      "disables)")(
+      "fragment-size", value<size_t>()->default_value(2000),
+      "plaintext bytes per AA frame once the session is up; falls back to "
+      "--fallback-fragment-size if the headunit stops responding")(
+      "fallback-fragment-size", value<size_t>()->default_value(2000),
+      "plaintext bytes per AA frame during setup and after a failed probe")(
+      "channel-budget", value<size_t>()->default_value(4 << 20),
+      "bytes allowed to wait for sending on one channel")(
+      "queue-budget", value<size_t>()->default_value(16 << 20),
+      "bytes allowed to wait for sending on all channels")(
+      "handler-threads", value<size_t>()->default_value(4),
+      "threads running channel handlers, for each headunit")(
+      "aio-depth", value<size_t>()->default_value(2),
+      "USB transfers kept in flight per bulk endpoint with AIO; 0 uses "
+      "blocking transfers for UDC drivers without working AIO")(
+      "overload-policy", value<vector<string>>()->composing(),
+      "class=policy, what to do with messages over budget; class is one of "
+      "control, input, audio, video and policy one of block, drop-oldest, "
+      "drop-non-keyframe (default video=drop-non-keyframe, others block)")(
+      "stats-interval", value<int>()->default_value(0),
+      "print statistics every given number of seconds (0 disables)")(
+      "udc", value<vector<int>>()->multitoken()->default_value({0}, "0"),
+      "ids of the UDCs to serve, one headunit each; clients talk to the first "
+      "one unless they send SelectSession, the video of UDC n>0 is read from "
+      "the mixer socket with n appended");
 
   variables_map vm;
   store(parse_command_line(argc, argv, desc), vm);
@@ -42,81 +140,246 @@ int main(int argc, char *argv[]) {
     cout << desc << "\n";
     return 1;
   }
-  string dumpfile;
+  CommunicatorOptions options;
   if (vm.count("dumpfile")) {
-    dumpfile = vm["dumpfile"].as<string>();
+    options.dumpfile = vm["dumpfile"].as<string>();
+  }
+  options.maxTransferSize = vm["ep1-transfer-size"].as<size_t>();
+  options.fragmentSize = vm["fragment-size"].as<size_t>();
+  options.fallbackFragmentSize = vm["fallback-fragment-size"].as<size_t>();
+  options.channelBudget = vm["channel-budget"].as<size_t>();
+  options.totalBudget = vm["queue-budget"].as<size_t>();
+  options.handlerThreads = vm["handler-threads"].as<size_t>();
+  options.aioDepth = vm["aio-depth"].as<size_t>();
+  if (vm.count("overload-policy")) {
+    for (auto &op : vm["overload-policy"].as<vector<string>>())
+      parseOverloadPolicy(options, op);
   }
+  auto statsInterval = vm["stats-interval"].as<int>();
+  bool verbose = vm.count("verbose");
+  auto udcIds = vm["udc"].as<vector<int>>();
+  quitFd = eventfd(0, EFD_CLOEXEC);
+  if (quitFd == -1)
+    throw runtime_error("eventfd failed");
   signal(SIGINT, signal_handler);
   gst_init(&argc, &argv);
   Library lib(configFsBasePath);
-  ModeSwitcher::handleSwitchToAccessoryMode(lib);
-  AaCommunicator aac(lib, dumpfile);
-  aac.setup(Udc::getUdcById(lib, 0));
+  Reactor reactor;
+  // shared by the sessions of all headunits, each one may use its share
+  WorkerPool handlerPool(options.handlerThreads * udcIds.size());
+  // the gadgets stay up across sessions, after an error only the session
+  // state is rebuilt and the headunit reconnects to the same gadget; they
+  // are prepared before the mode switch, which then only has to bind them
+  PhaseTimer startupTimer("startup");
+  map<int, unique_ptr<HeadunitPort>> ports;
+  for (auto udcId : udcIds) {
+    if (ports.count(udcId))
+      throw runtime_error("UDC " + to_string(udcId) + " given twice");
+    ports[udcId] = make_unique<HeadunitPort>(lib, reactor, udcId,
+                                             options.handlerThreads);
+    startupTimer.mark("gadgets" + to_string(udcId));
+  }
+  startupTimer.report(cout);
+  auto withSession = [&](int udcId, auto fun) {
+    auto port = ports.find(udcId);
+    if (port == ports.end())
+      throw runtime_error("no UDC " + to_string(udcId));
+    shared_lock<shared_mutex> lk(port->second->sessionMutex);
+    if (!port->second->session)
+      throw runtime_error("no session");
+    return fun(*port->second->session);
+  };
   mutex error_mutex;
-  aac.error.connect([&](const std::exception &ex) {
-    unique_lock ul(error_mutex);
-    cout << "Error: " << ex.what() << endl;
-    if (const aa_runtime_error *are =
-            dynamic_cast<const aa_runtime_error *>(&ex)) {
-      cout << "StackTrace:" << endl;
-      are->printTrace(cout);
-    }
-    mre.set();
-  });
-  map<SocketClient *, int> clients;
-  int hi = 0;
-  aac.gotMessage.connect([&clients, &hi](int clientId, int channelNumber,
-                                         bool specific, vector<uint8_t> data) {
-    cout << hi++ << " data from headunit: " << channelNumber << " "
-         << data.size() << endl;
-    vector<uint8_t> msg;
-    msg.push_back(channelNumber);
-    msg.push_back(specific ? 0xff : 0x00);
-    copy(data.begin(), data.end(), back_inserter(msg));
-    for (auto cl : clients) {
-      if (cl.second == clientId || clientId == -1)
-        try {
-          cl.first->sendMessage(msg);
-        } catch (client_disconnected_error &cde) {
-        }
-    }
-  });
-  SocketCommunicator sc("./socket");
-  int pi = 0;
+  // clients talk to the session of one UDC, the first one unless they
+  // select another
+  auto defaultUdcId = udcIds.front();
+  mutex clientsMutex;
+  map<SocketClient *, ClientInfo> clients;
+  auto clientInfo = [&](SocketClient *scl) {
+    unique_lock<mutex> lk(clientsMutex);
+    return clients.at(scl);
+  };
+  auto sessionDisconnected = [&](int udcId, int clientId) {
+    auto &port = *ports.at(udcId);
+    shared_lock<shared_mutex> lk(port.sessionMutex);
+    if (port.session)
+      port.session->disconnected(clientId);
+  };
+  atomic<int> hi(0);
+  SocketCommunicator sc(reactor, "./socket",
+                        clientThreadsPerPort * ports.size());
   int clientCount = 0;
   sc.newClient.connect([&](SocketClient *scl) {
-    clients.insert({scl, clientCount++});
-    cout << "connect: " << clients[scl] << endl;
-    scl->gotPacket.connect([&aac, scl, &pi, &clients](const Packet &p) {
+    {
+      unique_lock<mutex> lk(clientsMutex);
+      clients.insert({scl, {clientCount++, defaultUdcId}});
+    }
+    scl->setShare(&ports.at(defaultUdcId)->clientShare);
+    cout << "connect: " << clientInfo(scl).id << endl;
+    scl->gotPacket.connect([&, scl](const Packet &p) {
+      auto client = clientInfo(scl);
       if (p.packetType == PacketType::GetChannelNumberByChannelType) {
-        auto channelId =
-            aac.getChannelNumberByChannelType((ChannelType)p.channelNumber);
+        auto channelId = withSession(client.udcId, [&](AaCommunicator &aac) {
+          return aac.getChannelNumberByChannelType(
+              (ChannelType)p.channelNumber);
+        });
         cout << "get channel: " << (int)p.channelNumber << "->"
              << (int)channelId << endl;
         scl->sendMessage({channelId});
       } else if (p.packetType == PacketType::RawData) {
-        try {
-          aac.sendToChannel(clients[scl], p.channelNumber, p.specific, p.data);
-        } catch (exception &ex) {
-          cout << "disconnect client: " << clients[scl] << " " << ex.what()
-               << endl;
-          aac.disconnected(clients[scl]);
-          clients.erase(scl);
-          throw;
-        }
+        withSession(client.udcId, [&](AaCommunicator &aac) {
+          try {
+            aac.sendToChannel(client.id, p.channelNumber, p.specific, p.data);
+          } catch (exception &ex) {
+            cout << "disconnect client: " << client.id << " " << ex.what()
+                 << endl;
+            aac.disconnected(client.id);
+            unique_lock<mutex> lk(clientsMutex);
+            clients.erase(scl);
+            throw;
+          }
+        });
       } else if (p.packetType == PacketType::GetServiceDescriptor) {
         cout << "get service descriptor" << endl;
-        scl->sendMessage(aac.getServiceDescriptor());
+        auto descriptor =
+            withSession(client.udcId, [](AaCommunicator &aac) {
+              return aac.getServiceDescriptor();
+            });
+        scl->sendMessage(descriptor);
+      } else if (p.packetType == PacketType::SetFragmentSize) {
+        const auto &data = *p.data;
+        if (data.size() != 4)
+          throw runtime_error("SetFragmentSize expects 4 bytes");
+        withSession(client.udcId, [&](AaCommunicator &aac) {
+          aac.setFragmentSize(data[0] << 24 | data[1] << 16 | data[2] << 8 |
+                              data[3]);
+        });
+      } else if (p.packetType == PacketType::SelectSession) {
+        if (!ports.count(p.channelNumber))
+          throw runtime_error("no UDC " + to_string(p.channelNumber));
+        cout << "client " << client.id << " selects UDC "
+             << (int)p.channelNumber << endl;
+        {
+          unique_lock<mutex> lk(clientsMutex);
+          clients.at(scl).udcId = p.channelNumber;
+        }
+        // later packets of this client block on the selected headunit only
+        scl->setShare(&ports.at(p.channelNumber)->clientShare);
+        if (client.udcId != p.channelNumber)
+          sessionDisconnected(client.udcId, client.id);
       } else {
         throw runtime_error("Unknown packetType");
       }
     });
-    scl->disconnected.connect([&aac, &clients, scl]() {
-      cout << "disconnected: " << clients[scl] << endl;
-      aac.disconnected(clients[scl]);
-      clients.erase(scl);
+    scl->disconnected.connect([&, scl]() {
+      ClientInfo client;
+      {
+        unique_lock<mutex> lk(clientsMutex);
+        auto it = clients.find(scl);
+        if (it == clients.end())
+          return;
+        client = it->second;
+        clients.erase(it);
+      }
+      cout << "disconnected: " << client.id << endl;
+      sessionDisconnected(client.udcId, client.id);
     });
   });
+  auto runPort = [&](HeadunitPort &port) {
+    // a headunit may never ask for accessory mode, quitting must not wait
+    // for it
+    if (quitting || !ModeSwitcher::handleSwitchToAccessoryMode(
+                        lib, port.initialGadget, port.gadget, port.udcId,
+                        quitFd))
+      return;
+    auto portOptions = options;
+    portOptions.videoSocketPath =
+        udcInstanceName(options.videoSocketPath, port.udcId);
+    if (!options.dumpfile.empty())
+      portOptions.dumpfile = udcInstanceName(options.dumpfile, port.udcId);
+    for (int sessionNumber = 0; !quitting; ++sessionNumber) {
+      auto name = fmt::format("udc {} session {}", port.udcId, sessionNumber);
+      cout << name << " starting" << endl;
+      auto aac = make_unique<AaCommunicator>(port.gadget, reactor, handlerPool,
+                                             &port.handlerShare, portOptions,
+                                             name);
+      aac->error.connect([&, name](const std::exception &ex) {
+        unique_lock ul(error_mutex);
+        cout << name << " error: " << ex.what() << endl;
+        if (const aa_runtime_error *are =
+                dynamic_cast<const aa_runtime_error *>(&ex)) {
+          cout << "StackTrace:" << endl;
+          are->printTrace(cout);
+        }
+        port.sessionEnded.set();
+      });
+      aac->gotMessage.connect([&](int clientId, int channelNumber,
+                                  bool specific, const SharedBuffer &data) {
+        // runs on the channel executors of several sessions at once, so hi
+        // is atomic; printing every message is too slow for video
+        if (verbose)
+          cout << hi++ << " data from headunit: " << channelNumber << " "
+               << data->size() << endl;
+        vector<uint8_t> header = {(uint8_t)channelNumber,
+                                  (uint8_t)(specific ? 0xff : 0x00)};
+        vector<SocketClient *> targets;
+        {
+          unique_lock<mutex> lk(clientsMutex);
+          for (auto &cl : clients) {
+            if (cl.second.udcId == port.udcId &&
+                (cl.second.id == clientId || clientId == -1))
+              targets.push_back(cl.first);
+          }
+        }
+        for (auto target : targets) {
+          try {
+            target->sendMessage(header, *data);
+          } catch (client_disconnected_error &cde) {
+          }
+        }
+      });
+      aac->start();
+      {
+        unique_lock<shared_mutex> lk(port.sessionMutex);
+        port.session = std::move(aac);
+      }
+      if (statsInterval > 0) {
+        while (!port.sessionEnded.waitFor(chrono::seconds(statsInterval))) {
+          ostringstream ostr;
+          port.session->reportStatistics(ostr);
+          cout << "udc " << port.udcId << " " << ostr.str() << flush;
+        }
+      } else {
+        port.sessionEnded.wait();
+      }
+      {
+        unique_lock<shared_mutex> lk(port.sessionMutex);
+        aac = std::move(port.session);
+      }
+      // clients reconnect and look up their channels again
+      sc.disconnectClients([&](SocketClient *scl) {
+        unique_lock<mutex> lk(clientsMutex);
+        auto it = clients.find(scl);
+        return it != clients.end() && it->second.udcId == port.udcId;
+      });
+      aac.reset();
+      port.sessionEnded.reset();
+    }
+  };
+  vector<thread> portThreads;
+  for (auto &[udcId, port] : ports) {
+    portThreads.push_back(thread([&runPort, &port = *port]() {
+      try {
+        runPort(port);
+      } catch (const exception &ex) {
+        cout << "udc " << port.udcId << ": " << ex.what() << endl;
+      }
+    }));
+  }
   mre.wait();
+  for (auto &[udcId, port] : ports)
+    port->sessionEnded.set();
+  for (auto &th : portThreads)
+    th.join();
   return 0;
 }
@@ -1,26 +1,25 @@
 // Distributed under GPLv3 only as specified in repository's root LICENSE file
 
 #include "AaCommunicator.h"
+#include "AccessoryGadget.h"
+#include "AioEndpoint.h"
+#include "BlockingEndpoint.h"
 #include "Channel.pb.h"
 #include "ChannelOpenRequest.pb.h"
-#include "Configuration.h"
 #include "DefaultChannelHandler.h"
-#include "FfsFunction.h"
+#include "H264.h"
 #include "InputChannelHandler.h"
 #include "MediaStreamType.pb.h"
 #include "Message.h"
+#include "MessageBuilder.h"
 #include "PingRequest.pb.h"
 #include "PingResponse.pb.h"
 #include "ServiceDiscoveryRequest.pb.h"
 #include "ServiceDiscoveryResponse.pb.h"
-#include "Udc.h"
 #include "VideoChannelHandler.h"
-#include "descriptors.h"
 #include "utils.h"
-#include <boost/filesystem.hpp>
 #include <boost/signals2.hpp>
 #include <cstdint>
-#include <fcntl.h>
 #include <fmt/core.h>
 #include <iostream>
 #include <linux/usb/functionfs.h>
@@ -28,29 +27,40 @@
 #include <openssl/ssl.h>
 #include <pcap/pcap.h>
 #include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 
 #define CRT_FILE "android_auto.crt"
 #define PRIVKEY_FILE "android_auto.key"
 #define DHPARAM_FILE "dhparam.pem"
 
 using namespace std;
-using namespace boost::filesystem;
 using namespace tag::aas;
 
-void AaCommunicator::logMessage(const Message &msg, bool direction) {
+// rings need a power of 2 capacity
+static size_t ringCapacity(size_t minimum) {
+  size_t capacity = 1;
+  while (capacity < minimum)
+    capacity <<= 1;
+  return capacity;
+}
+
+void AaCommunicator::logMessage(uint8_t channel, uint8_t flags,
+                                const uint8_t *content, size_t size,
+                                bool direction) {
   if (!pdumper)
     return;
-  int pktSize = 8 + msg.content.size();
+  int pktSize = 8 + size;
   uint8_t buffer[pktSize];
   buffer[0] = 0;
   buffer[1] = 0;
   buffer[2] = 0;
   buffer[3] = 0;
-  buffer[4] = msg.channel;
-  buffer[5] = msg.flags;
+  buffer[4] = channel;
+  buffer[5] = flags;
   buffer[6] = direction ? 1 : 0;
   buffer[7] = 0;
-  copy(msg.content.begin(), msg.content.end(), buffer + 8);
+  copy(content, content + size, buffer + 8);
   struct pcap_pkthdr packet_header;
   gettimeofday(&packet_header.ts, NULL);
   packet_header.caplen = pktSize;
@@ -58,28 +68,123 @@ void AaCommunicator::logMessage(const Message &msg, bool direction) {
   pcap_dump((unsigned char *)pdumper, &packet_header, buffer);
 }
 
-void AaCommunicator::sendMessage(uint8_t channel, uint8_t flags,
-                                 const std::vector<uint8_t> &buf) {
-  Message msg;
-  msg.channel = channel;
-  msg.flags = flags;
-  msg.content = buf;
-  logMessage(msg, true);
-  {
-    std::unique_lock<std::mutex> lk(sendQueueMutex);
-    sendQueue.push_back(msg);
+// size of the media header in front of the samples, 0 for other messages
+static size_t mediaHeaderSize(const OutgoingMessage &msg) {
+  auto content = msg.payload();
+  if (msg.channel == 0 || msg.payloadSize() < 2)
+    return 0;
+  auto messageType = content[0] << 8 | content[1];
+  if (messageType == MediaMessageType::MediaWithTimestampIndication)
+    return 10;
+  if (messageType == MediaMessageType::MediaIndication)
+    return 2;
+  return 0;
+}
+
+void AaCommunicator::classifyMessage(OutgoingMessage &msg,
+                                     OverloadPolicy policy) {
+  auto content = msg.payload();
+  auto size = msg.payloadSize();
+  if (policy == BlockPolicy)
+    return;
+  auto headerSize = mediaHeaderSize(msg);
+  if (headerSize == 0)
+    return;
+  msg.droppable = true;
+  if (policy == DropNonKeyframePolicy && size > headerSize) {
+    auto au = h264Parse(content + headerSize, size - headerSize);
+    msg.keyframe = au.idr;
+    msg.reference = au.reference;
+    // parameter sets outside of a keyframe are needed by the frames after it
+    if (au.parameterSets && !au.idr)
+      msg.droppable = false;
+  }
+}
+
+void AaCommunicator::dropMessage(const OutgoingMessage &msg) {
+  auto priority = scheduler.getPriority(msg.channel);
+  droppedMessages[priority]->add();
+  droppedBytes[priority]->add(msg.payloadSize());
+}
+
+bool AaCommunicator::sendMessage(OutgoingMessage msg) {
+  auto channel = msg.channel;
+  auto size = msg.payloadSize();
+  logMessage(channel, msg.flags, msg.payload(), size, true);
+  auto priority = scheduler.getPriority(channel);
+  auto policy = options.overloadPolicies[priority];
+  classifyMessage(msg, policy);
+
+  // the only place that drops samples up to the next keyframe, handlers
+  // only classify them
+  if (policy == DropNonKeyframePolicy && msg.droppable && !msg.keyframe &&
+      (waitingForKeyframe[channel] || msg.congested ||
+       budget.exceeded(channel, size))) {
+    dropMessage(msg);
+    if (waitingForKeyframe[channel]) {
+      dependentDrops.add();
+    } else if (!msg.reference) {
+      // nothing is predicted from it, the stream goes on
+      nonReferenceDrops.add();
+    } else {
+      referenceDrops.add();
+      keyframeLost[channel] = chrono::steady_clock::now();
+      waitingForKeyframe[channel] = true;
+      // without it the stream recovers only with the encoder's next
+      // periodic keyframe
+      if (auto handler = channelHandlers[channel])
+        handler->requestKeyframe();
+    }
+    return false;
+  }
+  if (msg.keyframe && waitingForKeyframe[channel].exchange(false)) {
+    auto us = chrono::duration_cast<chrono::microseconds>(
+                  chrono::steady_clock::now() - keyframeLost[channel])
+                  .count();
+    recoveries.add();
+    recoveryUs.add(us);
+    recoveryMaxUs.max(us);
+  }
+  // drop-oldest makes room on the encrypting thread, keyframes are let in
+  // and replace whatever is queued before them
+  if (!msg.droppable && budget.exceeded(channel, size)) {
+    auto blockStart = chrono::steady_clock::now();
+    auto fits = budget.waitForSpace(channel, size);
+    blockedUs[priority]->add(chrono::duration_cast<chrono::microseconds>(
+                                 chrono::steady_clock::now() - blockStart)
+                                 .count());
+    // suspended or stopping, the handler has to get to its next task
+    if (!fits) {
+      dropMessage(msg);
+      return false;
+    }
+  }
+  budget.add(channel, size);
+
+  auto pushStart = chrono::steady_clock::now();
+  while (!sendQueue.tryPush(msg)) {
+    if (threadFinished)
+      return false;
+    sendQueueFullWaits.add();
+    this_thread::sleep_for(1ms);
   }
-  sendQueueNotEmpty.notify_all();
+  auto pushNs = chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now() - pushStart)
+                    .count();
+  sendQueuePushNs.add(pushNs);
+  sendQueuePushMaxNs.max(pushNs);
+  messagesSent.add();
+  return true;
 }
 
 void AaCommunicator::sendVersionResponse(__u16 major, __u16 minor) {
-  std::vector<uint8_t> msg;
-  pushBackInt16(msg, MessageType::VersionResponse);
-  pushBackInt16(msg, major);
-  pushBackInt16(msg, minor);
+  MessageBuilder msg(0, EncryptionType::Plain | FrameType::Bulk,
+                     MessageType::VersionResponse, 3 * sizeof(__u16));
+  msg.pushBackInt16(major);
+  msg.pushBackInt16(minor);
   // 0 => version match
-  pushBackInt16(msg, 0);
-  sendMessage(0, EncryptionType::Plain | FrameType::Bulk, msg);
+  msg.pushBackInt16(0);
+  sendMessage(msg.build());
 }
 
 void AaCommunicator::handleVersionRequest(const void *buf, size_t nbytes) {
@@ -90,17 +195,16 @@ void AaCommunicator::handleVersionRequest(const void *buf, size_t nbytes) {
     sendVersionResponse(1, 5);
   else
     throw std::runtime_error("unsupported version");
+  connectTimer.mark("versionRequest");
 }
 
 void AaCommunicator::sendServiceDiscoveryRequest() {
   class ServiceDiscoveryRequest sdr;
   sdr.set_manufacturer("TAG");
   sdr.set_model("AAServer");
-  auto msgString = sdr.SerializeAsString();
-  std::vector<uint8_t> plainMsg;
-  pushBackInt16(plainMsg, MessageType::ServiceDiscoveryRequest);
-  std::copy(msgString.begin(), msgString.end(), std::back_inserter(plainMsg));
-  sendMessage(0, EncryptionType::Encrypted | FrameType::Bulk, plainMsg);
+  MessageBuilder msg(0, EncryptionType::Encrypted | FrameType::Bulk,
+                     MessageType::ServiceDiscoveryRequest, sdr);
+  sendMessage(msg.build());
 }
 
 void AaCommunicator::handleServiceDiscoveryResponse(const void *buf,
@@ -109,34 +213,62 @@ void AaCommunicator::handleServiceDiscoveryResponse(const void *buf,
   class tag::aas::ServiceDiscoveryResponse sdr;
   sdr.ParseFromArray(buf, nbytes);
   std::cout << sdr.DebugString() << std::endl;
+  {
+    // the reactor thread posts the ping that follows the fragment size probe
+    std::unique_lock<std::mutex> lk(channelsMutex);
+    channelExecutor(0);
+  }
   for (auto ch : sdr.channels()) {
+    auto id = ch.channel_id();
+    SerialExecutor *executor;
+    {
+      // created here so that the reactor thread can post to it
+      std::unique_lock<std::mutex> lk(channelsMutex);
+      executor = &channelExecutor(id);
+    }
+    // handlers register timers with the reactor, which may be waiting for
+    // channelsMutex in setPowerState; they are built without holding it
+    ChannelHandler *handler;
     if (ch.has_media_channel() &&
         ch.media_channel().media_type() ==
             MediaStreamType_Enum::MediaStreamType_Enum_Video) {
-      channelTypeToChannelNumber[ChannelType::Video] = ch.channel_id();
-      channelHandlers[ch.channel_id()] =
-          new VideoChannelHandler(ch.channel_id());
+      channelTypeToChannelNumber[ChannelType::Video] = id;
+      scheduler.setPriority(id, VideoPriority);
+      auto video = new VideoChannelHandler(
+          id, options.videoSocketPath, options.overloadPolicies[VideoPriority],
+          statistics, reactor, *executor);
+      video->firstSampleSent.connect(
+          [this]() { connectTimer.mark("firstVideoSample"); });
+      video->sampleAcked.connect(
+          [this](uint64_t sampleId) { fragmentSize.sampleAcked(sampleId); });
+      handler = video;
     } else if (ch.has_input_channel()) {
-      channelTypeToChannelNumber[ChannelType::Input] = ch.channel_id();
+      scheduler.setPriority(id, InputPriority);
+      channelTypeToChannelNumber[ChannelType::Input] = id;
       auto available_buttons = ch.input_channel().available_buttons();
-      channelHandlers[ch.channel_id()] =
-          new InputChannelHandler(ch.channel_id(), {available_buttons.begin(),
-                                                    available_buttons.end()});
+      handler = new InputChannelHandler(
+          id, {available_buttons.begin(), available_buttons.end()}, reactor,
+          *executor);
     } else {
-      channelHandlers[ch.channel_id()] =
-          new DefaultChannelHandler(ch.channel_id());
+      if (ch.has_media_channel())
+        scheduler.setPriority(id, AudioPriority);
+      handler = new DefaultChannelHandler(id);
     }
-    channelHandlers[ch.channel_id()]->sendToClient.connect(
-        [this](int clientId, uint8_t channelNumber, bool specific,
-               std::vector<uint8_t> data) {
-          gotMessage(clientId, channelNumber, specific, data);
-        });
-    channelHandlers[ch.channel_id()]->sendToHeadunit.connect(
-        [this](uint8_t channelNumber, uint8_t flags,
-               std::vector<uint8_t> data) {
-          sendMessage(channelNumber, flags, data);
-        });
+    handler->sendToClient.connect([this](int clientId, uint8_t channelNumber,
+                                         bool specific,
+                                         const SharedBuffer &data) {
+      gotMessage(clientId, channelNumber, specific, data);
+    });
+    handler->sendToHeadunit.connect(
+        [this](OutgoingMessage msg) { return sendMessage(std::move(msg)); });
+    handler->phaseReached.connect([this, id](const string &phase) {
+      connectTimer.mark(fmt::format("channel{}.{}", id, phase));
+    });
+    std::unique_lock<std::mutex> lk(channelsMutex);
+    channelHandlers[id] = handler;
   }
+  fragmentSize.sessionReady();
+  connectTimer.mark("serviceDiscovery");
 }
 
 uint8_t AaCommunicator::getChannelNumberByChannelType(ChannelType ct) {
@@ -147,31 +279,43 @@ uint8_t AaCommunicator::getChannelNumberByChannelType(ChannelType ct) {
   return channelId;
 }
 
+SerialExecutor &AaCommunicator::channelExecutor(uint8_t channel) {
+  auto &executor = channelExecutors[channel];
+  if (!executor)
+    executor = make_unique<SerialExecutor>(handlerPool, handlerShare);
+  return *executor;
+}
+
+void AaCommunicator::postChannelMessage(const Message &message) {
+  channelExecutor(message.channel).post([this, message]() {
+    try {
+      handleChannelMessage(message);
+    } catch (const std::exception &ex) {
+      threadTerminated(ex);
+    }
+  });
+}
+
 void AaCommunicator::handleChannelMessage(const Message &message) {
-  auto msg = message.content;
-  const __u16 *shortView = (const __u16 *)(msg.data());
+  const __u16 *shortView = (const __u16 *)(message.content->data());
   auto messageType = be16_to_cpu(shortView[0]);
-  {
-    std::unique_lock<std::mutex> lk(m);
-    if (message.channel != 0) {
-      auto handled =
-          this->channelHandlers[message.channel]->handleMessageFromHeadunit(
-              message);
-      if (!handled) {
-        throw aa_runtime_error(
-            fmt::format("Unknown packet on channel {0} with message type {1}",
-                        to_string(message.channel), to_string(messageType)));
-      }
-    } else {
-      gotMessage(-1, message.channel,
-                 message.flags & MessageTypeFlags::Specific, msg);
+  if (message.channel != 0) {
+    auto handled =
+        this->channelHandlers[message.channel]->handleMessageFromHeadunit(
+            message);
+    if (!handled) {
+      throw aa_runtime_error(
+          fmt::format("Unknown packet on channel {0} with message type {1}",
+                      to_string(message.channel), to_string(messageType)));
     }
+  } else {
+    gotMessage(-1, message.channel,
+               message.flags & MessageTypeFlags::Specific, message.content);
   }
-  cv.notify_all();
 }
 
 void AaCommunicator::sendToChannel(int clientId, uint8_t channelNumber,
-                                   bool specific, const vector<uint8_t> &data) {
+                                   bool specific, const SharedBuffer &data) {
   if (channelHandlers[channelNumber] == nullptr) {
     throw std::runtime_error("No handler for channel " +
                              to_string(channelNumber));
@@ -191,43 +335,51 @@ std::vector<uint8_t> AaCommunicator::getServiceDescriptor() {
   return serviceDescriptor;
 }
 
-std::vector<uint8_t>
-AaCommunicator::decryptMessage(const std::vector<uint8_t> &encryptedMsg) {
+void AaCommunicator::reportStatistics(std::ostream &ostr) {
+  statistics.report(ostr);
+}
+
+void AaCommunicator::setFragmentSize(size_t size) { fragmentSize.set(size); }
+
+size_t AaCommunicator::decryptMessage(const uint8_t *encrypted, size_t size,
+                                      uint8_t *plain, size_t capacity) {
+  std::unique_lock<std::mutex> lk(sslMutex);
   ERR_clear_error();
 
-  auto bytesWritten =
-      BIO_write(readBio, encryptedMsg.data(), encryptedMsg.size());
+  auto bytesWritten = BIO_write(readBio, encrypted, size);
   if (bytesWritten < 0) {
     throw std::runtime_error("BIO_write failed");
   }
-  const int plainBufSize = 100 * 1024;
-  char plainBuf[plainBufSize];
-  auto ret = SSL_read(ssl, plainBuf, plainBufSize);
+  auto ret = SSL_read(ssl, plain, capacity);
   if (ret < 0) {
     auto err = SSL_get_error(ssl, ret);
     ERR_print_errors_fp(stdout);
     auto message = "SSL_read failed: " + std::to_string(ret);
     message += " " + std::to_string(err);
-    message += " " + std::to_string(encryptedMsg.size());
+    message += " " + std::to_string(size);
     message += " " + std::to_string(bytesWritten);
     if (err == SSL_ERROR_SSL)
       message += " "s + ERR_error_string(ERR_get_error(), NULL);
     throw std::runtime_error(message);
   }
-  return std::vector<uint8_t>(plainBuf, plainBuf + ret);
+  // a record that does not fit would be returned by the next SSL_read as
+  // the start of another fragment
+  if (SSL_pending(ssl) > 0)
+    throw aa_runtime_error("fragment longer than announced message");
+  return ret;
 }
 
 void AaCommunicator::handleMessageContent(const Message &message) {
-  logMessage(message, false);
-  auto msg = message.content;
+  const auto &msg = *message.content;
+  logMessage(message.channel, message.flags, msg.data(), msg.size(), false);
   const __u16 *shortView = (const __u16 *)msg.data();
   MessageType messageType = (MessageType)be16_to_cpu(shortView[0]);
   if (message.channel != 0) {
-    handleChannelMessage(message);
+    postChannelMessage(message);
   } else if (messageType == MessageType::AudioFocusResponse) {
-    handleChannelMessage(message);
+    postChannelMessage(message);
   } else if (messageType == MessageType::NavigationFocusResponse) {
-    handleChannelMessage(message);
+    postChannelMessage(message);
   } else if (messageType == MessageType::VersionRequest) {
     cout << "got version request" << endl;
     handleVersionRequest(shortView + 1, msg.size() - sizeof(__u16));
@@ -236,6 +388,7 @@ void AaCommunicator::handleMessageContent(const Message &message) {
     handleSslHandshake(shortView + 1, msg.size() - sizeof(__u16));
   } else if (messageType == MessageType::AuthComplete) {
     cout << "auth complete" << endl;
+    connectTimer.mark("authComplete");
     sendServiceDiscoveryRequest();
   } else if (messageType == MessageType::ServiceDiscoveryResponse) {
     cout << "got service discovery response" << endl;
@@ -243,6 +396,10 @@ void AaCommunicator::handleMessageContent(const Message &message) {
   } else if (messageType == MessageType::PingRequest) {
     cout << "got ping request" << endl;
     handlePingRequest(shortView + 1, msg.size() - sizeof(__u16));
+  } else if (messageType == MessageType::PingResponse) {
+    // the only ping we send follows the fragment size probe
+    cout << "got ping response" << endl;
+    fragmentSize.pingAnswered();
   } else {
     throw std::runtime_error("Unhandled message type: " +
                              std::to_string(messageType));
@@ -256,18 +413,23 @@ void AaCommunicator::handlePingRequest(const void *buf, size_t nbytes) {
 
   tag::aas::PingResponse presp;
   presp.set_timestamp(preq.timestamp());
-  int bufSize = presp.ByteSize();
-  uint8_t buffer[bufSize];
-  if (!presp.SerializeToArray(buffer, bufSize))
-    throw aa_runtime_error("presp.SerializeToArray failed");
+  MessageBuilder msg(0, EncryptionType::Encrypted | FrameType::Bulk,
+                     MessageType::PingResponse, presp);
+  sendMessage(msg.build());
+}
 
-  std::vector<uint8_t> plainMsg;
-  pushBackInt16(plainMsg, MessageType::PingResponse);
-  copy(buffer, buffer + bufSize, std::back_inserter(plainMsg));
-  sendMessage(0, EncryptionType::Encrypted | FrameType::Bulk, plainMsg);
+void AaCommunicator::sendPingRequest() {
+  tag::aas::PingRequest preq;
+  preq.set_timestamp(chrono::duration_cast<chrono::microseconds>(
+                         chrono::steady_clock::now().time_since_epoch())
+                         .count());
+  MessageBuilder msg(0, EncryptionType::Encrypted | FrameType::Bulk,
+                     MessageType::PingRequest, preq);
+  sendMessage(msg.build());
 }
 
 void AaCommunicator::handleSslHandshake(const void *buf, size_t nbytes) {
+  std::unique_lock<std::mutex> lk(sslMutex);
   initializeSsl();
   BIO_write(readBio, buf, nbytes);
 
@@ -278,15 +440,17 @@ void AaCommunicator::handleSslHandshake(const void *buf, size_t nbytes) {
       throw runtime_error("SSL_accept failed");
   }
 
-  std::vector<uint8_t> msg;
-  pushBackInt16(msg, MessageType::SslHandshake);
+  MessageBuilder msg(0, EncryptionType::Plain | FrameType::Bulk,
+                     MessageType::SslHandshake, BIO_pending(writeBio));
   auto bufferSize = 512;
   char buffer[bufferSize];
   int len;
   while ((len = BIO_read(writeBio, buffer, bufferSize)) != -1) {
-    std::copy(buffer, buffer + len, std::back_inserter(msg));
+    msg.append(buffer, len);
   }
-  sendMessage(0, EncryptionType::Plain | FrameType::Bulk, msg);
+  lk.unlock();
+  sendMessage(msg.build());
+  connectTimer.mark(fmt::format("sslHandshake{}", ++sslRounds));
 }
 
 void AaCommunicator::initializeSsl() {
@@ -341,239 +505,618 @@ int AaCommunicator::verifyCertificate(int preverify_ok,
   return 1;
 }
 
-ssize_t AaCommunicator::handleMessage(int fd, const void *buf, size_t nbytes) {
-  const uint8_t *byteView = (const uint8_t *)buf;
+size_t AaCommunicator::handleFrame(const uint8_t *byteView, size_t nbytes) {
+  if (nbytes < 4)
+    throw std::runtime_error("nbytes<4");
   int channel = byteView[0];
   int flags = byteView[1];
-  bool encrypted = flags & 0x8;
-  FrameType frameType = (FrameType)(flags & 0x3);
-  int lengthRaw = *(__u16 *)(byteView + 2);
-  int length = be16_to_cpu(*(__u16 *)(byteView + 2));
-  std::vector<uint8_t> msg;
-  if (nbytes < 4 + length)
-    throw std::runtime_error("nbytes<4+length");
-  std::copy(byteView + 4, byteView + 4 + length, std::back_inserter(msg));
-  Message message;
-  message.channel = channel;
-  message.flags = flags;
-  message.content = encrypted ? decryptMessage(msg) : msg;
-  handleMessageContent(message);
-  return length + 4;
-}
-
-ssize_t AaCommunicator::getMessage(int fd, void *buf, size_t nbytes) {
-  std::unique_lock<std::mutex> lk(sendQueueMutex);
-  if (!sendQueueNotEmpty.wait_for(lk, 1s, [=] { return !sendQueue.empty(); })) {
-    errno = EINTR;
-    return 0;
-  }
+  bool encrypted = flags & EncryptionType::Encrypted;
+  auto frameType = flags & FrameType::Bulk;
+  size_t length = be16_to_cpu(*(__u16 *)(byteView + 2));
+  size_t headerSize = frameType == FrameType::First ? 8 : 4;
+  if (nbytes < headerSize + length)
+    throw std::runtime_error("nbytes<headerSize+length");
+  auto fragment = byteView + headerSize;
 
-  // it should work up to about 16k, but we might get some weird hardware issues
-  int maxSize = 2000;
+  auto &r = reassembly[channel];
+  if (frameType == FrameType::First) {
+    uint32_t totalLength = byteView[4] << 24 | byteView[5] << 16 |
+                           byteView[6] << 8 | byteView[7];
+    r.start(receiveBuffers, flags, totalLength);
+  } else if (frameType == FrameType::Bulk) {
+    // plaintext is never longer than the record carrying it
+    r.start(receiveBuffers, flags, length);
+  } else if (!r.inProgress()) {
+    throw aa_runtime_error(
+        fmt::format("fragment without first fragment on channel {}", channel));
+  }
+  size_t plainLength;
+  if (encrypted) {
+    plainLength =
+        decryptMessage(fragment, length, r.freeSpace(), r.freeSize());
+  } else {
+    if (length > r.freeSize())
+      throw aa_runtime_error("fragment longer than announced message");
+    std::copy(fragment, fragment + length, r.freeSpace());
+    plainLength = length;
+    payloadBytesReceivedCopied.add(length);
+  }
+  r.commit(plainLength);
+  framesReceived.add();
+  payloadBytesReceived.add(plainLength);
 
-  auto msg = sendQueue.front();
-  uint32_t totalLength = msg.content.size();
-  std::vector<uint8_t> msgBytes;
-  if (msg.flags & EncryptionType::Encrypted) {
-    msgBytes.push_back(msg.channel);
-    auto flags = msg.flags;
-    std::vector<uint8_t>::iterator contentBegin;
-    std::vector<uint8_t>::iterator contentEnd;
-    // full frame
-    if (msg.content.size() - msg.offset <= maxSize &&
-        (flags & FrameType::Bulk)) {
-      contentBegin = msg.content.begin() + msg.offset;
-      contentEnd = msg.content.end();
-      sendQueue.pop_front();
+  if (frameType == FrameType::Last || frameType == FrameType::Bulk) {
+    Message *message;
+    while (!(message = receivedMessages.producerSlot())) {
+      if (threadFinished)
+        return nbytes;
+      receivedMessages.waitNotFull();
     }
-    // first frame
-    else if (msg.content.size() - msg.offset > maxSize &&
-             (flags & FrameType::Bulk)) {
-      flags = flags & ~FrameType::Bulk;
-      flags = flags | FrameType::First;
-      contentBegin = msg.content.begin() + msg.offset;
-      contentEnd = msg.content.begin() + msg.offset + maxSize;
-      sendQueue.front().flags = flags & ~FrameType::Bulk;
-      sendQueue.front().offset += maxSize;
+    message->channel = channel;
+    message->flags = r.messageFlags() | FrameType::Bulk;
+    message->content = r.finish();
+    receivedMessages.publish();
+    receivedMessagesDepth.set(receivedMessages.size());
+    messagesReceived.add();
+  }
+  return headerSize + length;
+}
+
+void AaCommunicator::submitReads() {
+  const size_t transferSize = 100 * 1024;
+  // every read goes into the ring slot it is published in, in order
+  while (ep2Io->inFlight() < ep2Io->depth()) {
+    auto transfer = receivedTransfers.producerSlot(ep2Io->inFlight());
+    if (!transfer) {
+      if (ep2Io->inFlight() > 0)
+        break;
+      // nothing is read until the decrypting thread frees a slot and posts
+      // submitReads again; the slot is checked again in case it already did
+      if (!readerStalled) {
+        readerStalled = true;
+        readerStallStart = chrono::steady_clock::now();
+      }
+      resumeReads = true;
+      atomic_thread_fence(memory_order_seq_cst);
+      if (!receivedTransfers.producerSlot())
+        return;
+      continue;
     }
-    // intermediate frame
-    else if (msg.content.size() - msg.offset > maxSize) {
-      contentBegin = msg.content.begin() + msg.offset;
-      contentEnd = msg.content.begin() + msg.offset + maxSize;
-      sendQueue.front().flags = flags & ~FrameType::Bulk;
-      sendQueue.front().offset += maxSize;
+    if (readerStalled) {
+      readerStalled = false;
+      readerStallUs.add(chrono::duration_cast<chrono::microseconds>(
+                            chrono::steady_clock::now() - readerStallStart)
+                            .count());
     }
-    // last frame
-    else {
-      contentBegin = msg.content.begin() + msg.offset;
-      contentEnd = msg.content.end();
-      flags = flags | FrameType::Last;
-      sendQueue.pop_front();
+    // slots keep their buffers, so this allocates only on the first round
+    transfer->buffer.resize(transferSize);
+    ep2Io->submitRead(transfer->buffer.data(), transfer->buffer.size());
+  }
+}
+
+void AaCommunicator::readsCompleted() {
+  ssize_t ret;
+  while (ep2Io->takeCompleted(ret)) {
+    // published even when empty, the next read already targets the next slot
+    receivedTransfers.producerSlot()->size = ret;
+    receivedTransfers.publish();
+    receivedTransfersDepth.set(receivedTransfers.size());
+    ep2Transfers.add();
+    ep2Bytes.add(ret);
+  }
+  submitReads();
+}
+
+void AaCommunicator::decryptPump() {
+  while (!threadFinished) {
+    auto transfer = receivedTransfers.consumerSlot();
+    if (!transfer) {
+      receivedTransfers.waitNotEmpty();
+      continue;
     }
-    msgBytes.push_back(flags);
-    auto ret = SSL_write(ssl, contentBegin.base(), contentEnd - contentBegin);
-    if (ret < 0) {
-      throw std::runtime_error("SSL_write error");
+    auto start = chrono::steady_clock::now();
+    size_t offset = 0;
+    while (offset < transfer->size)
+      offset += handleFrame(transfer->buffer.data() + offset,
+                            transfer->size - offset);
+    receivedTransfers.pop();
+    receivedTransfersDepth.set(receivedTransfers.size());
+    atomic_thread_fence(memory_order_seq_cst);
+    if (resumeReads.exchange(false))
+      reactor.post([this]() { runGuarded([this]() { submitReads(); }); });
+    decryptBusyUs.add(chrono::duration_cast<chrono::microseconds>(
+                          chrono::steady_clock::now() - start)
+                          .count());
+  }
+}
+
+void AaCommunicator::dispatchPump() {
+  while (!threadFinished) {
+    auto message = receivedMessages.consumerSlot();
+    if (!message) {
+      receivedMessages.waitNotEmpty();
+      continue;
     }
-    lk.unlock();
-    auto encBuf = (uint8_t *)buf;
+    auto start = chrono::steady_clock::now();
+    handleMessageContent(*message);
+    // gives the buffer back to the pool unless a handler kept it
+    message->content.reset();
+    receivedMessages.pop();
+    receivedMessagesDepth.set(receivedMessages.size());
+    dispatchBusyUs.add(chrono::duration_cast<chrono::microseconds>(
+                           chrono::steady_clock::now() - start)
+                           .count());
+  }
+}
+
+void AaCommunicator::prepareFrame(OutgoingMessage &msg, ReadyFrame &frame) {
+  // it should work up to about 16k, but we might get some weird hardware
+  // issues, so the size is probed at runtime
+  size_t maxSize = fragmentSize.get();
+  fragmentSizeGauge.set(maxSize);
+
+  auto content = msg.payload();
+  uint32_t totalLength = msg.payloadSize();
+  if (msg.flags & EncryptionType::Encrypted) {
+    auto fragmentLength = std::min(totalLength - msg.offset, maxSize);
+    auto flags = msg.flags & ~FrameType::Bulk;
+    if (msg.offset == 0)
+      flags |= FrameType::First;
+    if (msg.offset + fragmentLength == totalLength)
+      flags |= FrameType::Last;
     auto offset = 4;
     if ((flags & FrameType::Bulk) == FrameType::First) {
       offset += 4;
     }
-    auto length = BIO_read(writeBio, encBuf + offset, nbytes - offset);
-    if (length < 0) {
-      throw std::runtime_error("BIO_read error");
+    auto &buffer = frame.buffer;
+    int length;
+    {
+      std::unique_lock<std::mutex> lk(sslMutex);
+      auto ret = SSL_write(ssl, content + msg.offset, fragmentLength);
+      if (ret < 0) {
+        throw std::runtime_error("SSL_write error");
+      }
+      buffer.resize(offset + BIO_pending(writeBio));
+      length =
+          BIO_read(writeBio, buffer.data() + offset, buffer.size() - offset);
+      if (length < 0) {
+        throw std::runtime_error("BIO_read error");
+      }
     }
-    encBuf[0] = msg.channel;
-    encBuf[1] = flags;
-    encBuf[2] = (length >> 8);
-    encBuf[3] = (length & 0xff);
+    buffer.resize(offset + length);
+    buffer[0] = msg.channel;
+    buffer[1] = flags;
+    buffer[2] = (length >> 8);
+    buffer[3] = (length & 0xff);
     if ((flags & FrameType::Bulk) == FrameType::First) {
-      encBuf[4] = ((totalLength >> 24) & 0xff);
-      encBuf[5] = ((totalLength >> 16) & 0xff);
-      encBuf[6] = ((totalLength >> 8) & 0xff);
-      encBuf[7] = ((totalLength >> 0) & 0xff);
+      buffer[4] = ((totalLength >> 24) & 0xff);
+      buffer[5] = ((totalLength >> 16) & 0xff);
+      buffer[6] = ((totalLength >> 8) & 0xff);
+      buffer[7] = ((totalLength >> 0) & 0xff);
     }
-    return length + offset;
+    frame.message.reset();
+    frame.data = buffer.data();
+    frame.size = buffer.size();
+    msg.offset += fragmentLength;
+    frame.probe = fragmentSize.isProbe(fragmentLength);
+    frame.sampleId = msg.sampleId;
+    payloadBytesSent.add(fragmentLength);
+  } else if (msg.headroom >= 4) {
+    // MessageBuilder already put the header in front of the payload
+    frame.message = msg.content;
+    frame.probe = false;
+    frame.data = content - 4;
+    frame.size = totalLength + 4;
+    msg.offset = totalLength;
+    payloadBytesSent.add(totalLength);
   } else {
-    sendQueue.pop_front();
-    msgBytes.push_back(msg.channel);
-    msgBytes.push_back(msg.flags);
-    int length = msg.content.size();
-    pushBackInt16(msgBytes, length);
-    std::copy(msg.content.begin(), msg.content.end(),
-              std::back_inserter(msgBytes));
-    std::copy(msgBytes.begin(), msgBytes.end(), (uint8_t *)buf);
-    return msgBytes.size();
-  }
-}
-
-ssize_t AaCommunicator::handleEp0Message(int fd, const void *buf,
-                                         size_t nbytes) {
-  const usb_functionfs_event *event = (const usb_functionfs_event *)buf;
-  for (size_t n = nbytes / sizeof *event; n; --n, ++event) {
-    std::cout << "ep0 event " << (int)event->type << " " << std::endl;
-    if (event->type == FUNCTIONFS_SUSPEND) {
-      throw std::runtime_error("ep0 suspend");
+    auto &buffer = frame.buffer;
+    buffer.resize(totalLength + 4);
+    buffer[0] = msg.channel;
+    buffer[1] = msg.flags;
+    buffer[2] = (totalLength >> 8);
+    buffer[3] = (totalLength & 0xff);
+    std::copy(content, content + totalLength, buffer.begin() + 4);
+    frame.message.reset();
+    frame.probe = false;
+    frame.data = buffer.data();
+    frame.size = buffer.size();
+    msg.offset = totalLength;
+    payloadBytesSent.add(totalLength);
+    payloadBytesCopied.add(totalLength);
+  }
+  framesSent.add();
+}
+
+void AaCommunicator::queueForSending(OutgoingMessage &&msg) {
+  auto channel = msg.channel;
+  auto keyframe = msg.keyframe;
+  auto congested = msg.droppable && msg.congested;
+  scheduler.push(std::move(msg));
+  auto excess = budget.excess(channel);
+  // the oldest waiting message makes room for one beyond the window
+  if (congested)
+    excess = std::max<size_t>(excess, 1);
+  if (excess == 0)
+    return;
+  auto dropped = [this](const OutgoingMessage &msg) {
+    budget.release(msg.channel, msg.payloadSize());
+    dropMessage(msg);
+    // it was accepted, the handler counted it as sent
+    if (auto handler = channelHandlers[msg.channel])
+      handler->messageDropped(msg);
+  };
+  auto policy = options.overloadPolicies[scheduler.getPriority(channel)];
+  if (policy == DropOldestPolicy)
+    scheduler.drop(channel, excess, 0, dropped);
+  else if (policy == DropNonKeyframePolicy && keyframe)
+    scheduler.drop(channel, SIZE_MAX, 1, dropped);
+}
+
+void AaCommunicator::drainSendQueue() {
+  while (auto msg = sendQueue.pop())
+    queueForSending(std::move(*msg));
+  queuedBytes.set(budget.queued());
+}
+
+void AaCommunicator::encryptPump() {
+  while (!threadFinished) {
+    if (scheduler.empty()) {
+      auto msg = sendQueue.pop();
+      if (!msg) {
+        sendQueue.wait(-1);
+        continue;
+      }
+      queueForSending(std::move(*msg));
+    }
+
+    // messages keep being accepted while the writer is busy, so that the
+    // overload policies see the whole backlog
+    ReadyFrame *frame;
+    while (!(frame = readyFrames.producerSlot())) {
+      if (threadFinished)
+        return;
+      drainSendQueue();
+      // the writer wakes the queue once a frame was written
+      resumeEncrypt = true;
+      atomic_thread_fence(memory_order_seq_cst);
+      if (readyFrames.full())
+        sendQueue.wait(-1);
+    }
+    // pick up everything queued while waiting, so the fragment below is
+    // chosen from the most recent state
+    drainSendQueue();
+    if (scheduler.empty())
+      continue;
+    auto &msg = scheduler.front();
+    if (msg.offset == 0) {
+      auto priority = scheduler.getPriority(msg.channel);
+      sendDelayUs[priority]->add(
+          chrono::duration_cast<chrono::microseconds>(
+              chrono::steady_clock::now() - msg.enqueued)
+              .count());
+      sendDelayMessages[priority]->add();
+    }
+    prepareFrame(msg, *frame);
+    frame->firstVideoFrame = false;
+    if (msg.offset >= msg.payloadSize()) {
+      budget.release(msg.channel, msg.payloadSize());
+      if (!firstVideoFrameQueued &&
+          msg.channel == channelTypeToChannelNumber[ChannelType::Video] &&
+          mediaHeaderSize(msg) > 0)
+        frame->firstVideoFrame = firstVideoFrameQueued = true;
+    }
+    scheduler.fragmentSent();
+    readyFrames.publish();
+    atomic_thread_fence(memory_order_seq_cst);
+    if (resumeWrites.exchange(false))
+      reactor.post([this]() { runGuarded([this]() { submitWrites(); }); });
+  }
+}
+
+void AaCommunicator::submitWrites() {
+  // written frames would only wait on the bus, the ready ones are submitted
+  // on resume
+  if (powerState == Suspended)
+    return;
+  const int maxBatch = 16;
+  struct iovec iov[maxBatch];
+  while (ep1Io->inFlight() < ep1Io->depth()) {
+    // several complete frames go out in one write as long as they fit into
+    // maxTransferSize; a frame is never split between writes
+    int count = 0;
+    size_t total = 0;
+    ReadyFrame *frame;
+    while (count < maxBatch &&
+           (frame = readyFrames.consumerSlot(framesInFlight + count))) {
+      if (count > 0 && total + frame->size > options.maxTransferSize)
+        break;
+      iov[count].iov_base = (void *)frame->data;
+      iov[count].iov_len = frame->size;
+      total += frame->size;
+      count++;
+    }
+    if (count == 0) {
+      // the encrypting thread posts submitWrites with its next frame; the
+      // ring is checked again in case it published in between
+      resumeWrites = true;
+      atomic_thread_fence(memory_order_seq_cst);
+      if (!readyFrames.consumerSlot(framesInFlight))
+        return;
+      continue;
+    }
+    ep1Syscalls.add();
+    ep1Io->submitWrite(iov, count);
+    framesPerWrite.push_back(count);
+    framesInFlight += count;
+  }
+}
+
+void AaCommunicator::writesCompleted() {
+  ssize_t ret;
+  while (ep1Io->takeCompleted(ret)) {
+    auto frames = framesPerWrite.front();
+    framesPerWrite.pop_front();
+    size_t expected = 0;
+    bool firstVideoFrame = false;
+    const ReadyFrame *probe = nullptr;
+    for (size_t i = 0; i < frames; ++i) {
+      auto frame = readyFrames.consumerSlot(i);
+      expected += frame->size;
+      firstVideoFrame |= frame->firstVideoFrame;
+      if (!probe && frame->probe)
+        probe = frame;
+    }
+    // later writes are already queued, a short one cannot be resumed
+    if ((size_t)ret != expected)
+      throw aa_runtime_error(
+          fmt::format("short write: {} of {}", ret, expected));
+    ep1Transfers.add();
+    ep1Bytes.add(ret);
+    ep1FramesPerTransferMax.max(frames);
+    // the headunit answers pings in order, so the response means it read
+    // the probe; video acks only confirm it if video is streaming
+    if (probe && fragmentSize.probeWritten(probe->sampleId)) {
+      std::unique_lock<std::mutex> lk(channelsMutex);
+      channelExecutors[0]->post([this]() {
+        try {
+          sendPingRequest();
+        } catch (const std::exception &ex) {
+          threadTerminated(ex);
+        }
+      });
+    }
+    if (firstVideoFrame) {
+      // covers the reconnect when the last session ended with an error
+      auto ms = chrono::duration_cast<chrono::milliseconds>(
+                    chrono::steady_clock::now() - sessionStart)
+                    .count();
+      firstVideoFrameMs.set(ms);
+      cout << "first video frame " << ms << " ms after session start"
+           << endl;
+      connectTimer.mark("firstVideoFrameWritten");
+      reportConnectTiming();
     }
+    framesInFlight -= frames;
+    readyFrames.pop(frames);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (resumeEncrypt.exchange(false))
+      sendQueue.wake();
   }
-  return nbytes;
+  submitWrites();
 }
 
-AaCommunicator::AaCommunicator(const Library &_lib, const std::string &dumpfile)
-    : lib(_lib) {
+void AaCommunicator::reportConnectTiming() {
+  if (!connectReported.exchange(true))
+    connectTimer.report(cout);
+}
+
+void AaCommunicator::handleEp0Event(const usb_functionfs_event &event) {
+  if (event.type == FUNCTIONFS_ENABLE) {
+    // a bus reset while suspended enables the function again
+    if (powerState == Suspended)
+      setPowerState(Active);
+    else
+      startTransfers();
+  } else if (event.type == FUNCTIONFS_SUSPEND) {
+    if (powerState == Active)
+      setPowerState(Suspended);
+  } else if (event.type == FUNCTIONFS_RESUME) {
+    if (powerState == Suspended)
+      setPowerState(Active);
+  } else if (event.type == FUNCTIONFS_DISABLE) {
+    // transfers in flight are cancelled and the headunit starts over with
+    // a version request, only a new session can follow
+    throw std::runtime_error("ep0 disable");
+  }
+}
+
+void AaCommunicator::setPowerState(PowerState state) {
+  auto now = chrono::steady_clock::now();
+  powerState = state;
+  bool suspended = state == Suspended;
+  if (suspended) {
+    suspends.add();
+    suspendStart = now;
+    cout << "USB suspended" << endl;
+  } else {
+    auto ms =
+        chrono::duration_cast<chrono::milliseconds>(now - suspendStart).count();
+    suspendedMs.add(ms);
+    cout << "USB resumed after " << ms << " ms" << endl;
+  }
+  budget.setSuspended(suspended);
+  {
+    std::unique_lock<std::mutex> lk(channelsMutex);
+    if (!threadFinished) {
+      for (int ch = 0; ch <= UINT8_MAX; ++ch) {
+        auto handler = channelHandlers[ch];
+        if (handler && channelExecutors[ch])
+          channelExecutors[ch]->post(
+              [handler, suspended]() { handler->setSuspended(suspended); });
+      }
+    }
+  }
+  if (!suspended)
+    submitWrites();
+}
+
+AaCommunicator::AaCommunicator(AccessoryGadget &_gadget, Reactor &_reactor,
+                               WorkerPool &_handlerPool,
+                               PoolShare *_handlerShare,
+                               const CommunicatorOptions &_options,
+                               const string &name)
+    : gadget(_gadget), reactor(_reactor), options(_options),
+      sessionStart(chrono::steady_clock::now()), connectTimer(name),
+      sendQueue(1024),
+      readyFrames(ringCapacity(
+          std::max<size_t>(options.maxTransferSize > 0 ? 8 : 2,
+                           options.aioDepth + 1))),
+      fragmentSize(options.fallbackFragmentSize, options.fragmentSize, 3s),
+      budget(options.channelBudget, options.totalBudget),
+      messagesSent(statistics.counter("send.messages")),
+      framesSent(statistics.counter("send.frames")),
+      payloadBytesSent(statistics.counter("send.payloadBytes")),
+      payloadBytesCopied(statistics.counter("send.payloadBytesCopied")),
+      fragmentSizeGauge(statistics.gauge("send.fragmentSize")),
+      sendQueuePushNs(statistics.counter("send.queuePushNs")),
+      sendQueuePushMaxNs(statistics.gauge("send.queuePushMaxNs")),
+      sendQueueFullWaits(statistics.counter("send.queueFullWaits")),
+      queuedBytes(statistics.gauge("send.queuedBytes")),
+      ep1Syscalls(statistics.counter("ep1.syscalls")),
+      ep1Transfers(statistics.counter("ep1.transfers")),
+      ep1Bytes(statistics.counter("ep1.bytes")),
+      ep1FramesPerTransferMax(statistics.gauge("ep1.framesPerTransferMax")),
+      ep2Transfers(statistics.counter("ep2.transfers")),
+      ep2Bytes(statistics.counter("ep2.bytes")),
+      framesReceived(statistics.counter("recv.frames")),
+      messagesReceived(statistics.counter("recv.messages")),
+      payloadBytesReceived(statistics.counter("recv.payloadBytes")),
+      payloadBytesReceivedCopied(
+          statistics.counter("recv.payloadBytesCopied")),
+      receiveBufferPoolMisses(statistics.counter("recv.bufferPoolMisses")),
+      readerStallUs(statistics.counter("recv.readerStallUs")),
+      decryptBusyUs(statistics.counter("recv.decryptBusyUs")),
+      dispatchBusyUs(statistics.counter("recv.dispatchBusyUs")),
+      receivedTransfersDepth(statistics.gauge("recv.transferQueueDepth")),
+      receivedMessagesDepth(statistics.gauge("recv.messageQueueDepth")),
+      firstVideoFrameMs(statistics.gauge("session.firstVideoFrameMs")),
+      nonReferenceDrops(statistics.counter("video.nonReferenceDrops")),
+      referenceDrops(statistics.counter("video.referenceDrops")),
+      dependentDrops(statistics.counter("video.dependentDrops")),
+      recoveries(statistics.counter("video.recoveries")),
+      recoveryUs(statistics.counter("video.recoveryUs")),
+      recoveryMaxUs(statistics.gauge("video.recoveryMaxUs")),
+      suspends(statistics.counter("power.suspends")),
+      suspendedMs(statistics.counter("power.suspendedMs")),
+      receivedTransfers(
+          ringCapacity(std::max<size_t>(8, 2 * options.aioDepth))),
+      receivedMessages(64),
+      receiveBuffers(receiveBufferPoolMisses),
+      handlerPool(_handlerPool), handlerShare(_handlerShare) {
+  const char *priorityNames[PriorityCount] = {"control", "input", "audio",
+                                              "video"};
+  for (int p = 0; p < PriorityCount; ++p) {
+    sendDelayUs[p] = &statistics.counter(
+        fmt::format("send.{}.queueDelayUs", priorityNames[p]));
+    sendDelayMessages[p] = &statistics.counter(
+        fmt::format("send.{}.messages", priorityNames[p]));
+    droppedMessages[p] = &statistics.counter(
+        fmt::format("send.{}.dropped", priorityNames[p]));
+    droppedBytes[p] = &statistics.counter(
+        fmt::format("send.{}.droppedBytes", priorityNames[p]));
+    blockedUs[p] = &statistics.counter(
+        fmt::format("send.{}.blockedUs", priorityNames[p]));
+  }
+  for (auto &waiting : waitingForKeyframe)
+    waiting = false;
   initializeSslContext();
   fill_n(channelTypeToChannelNumber, ChannelType::MaxValue, -1);
   fill_n(channelHandlers, UINT8_MAX + 1, nullptr);
   channelHandlers[0] = new DefaultChannelHandler(0);
   channelHandlers[0]->sendToClient.connect(
       [this](int clientId, uint8_t channelNumber, bool specific,
-             std::vector<uint8_t> data) {
+             const SharedBuffer &data) {
         gotMessage(clientId, channelNumber, specific, data);
       });
   channelHandlers[0]->sendToHeadunit.connect(
-      [this](uint8_t channelNumber, uint8_t flags, std::vector<uint8_t> data) {
-        sendMessage(channelNumber, flags, data);
-      });
-  cout << "dumpfile: " << dumpfile << endl;
+      [this](OutgoingMessage msg) { return sendMessage(std::move(msg)); });
+  cout << "dumpfile: " << options.dumpfile << endl;
 
-  if (!dumpfile.empty()) {
+  if (!options.dumpfile.empty()) {
     pd = pcap_open_dead(DLT_NULL, 65535);
-    pdumper = pcap_dump_open(pd, dumpfile.c_str());
+    pdumper = pcap_dump_open(pd, options.dumpfile.c_str());
   }
 }
 
-void AaCommunicator::setup(const Udc &udc) {
-  mainGadget =
-      unique_ptr<Gadget>(new Gadget(lib, 0x18d1, 0x2d00, rr("main_state")));
-  mainGadget->setStrings("TAG", "AAServer", sr("TAGAAS"));
-
-  auto tmpMountpoint = boost::filesystem::temp_directory_path() /
-                       rr("AAServer_mp_loopback_main");
-  create_directory(tmpMountpoint);
-  ffs_function = unique_ptr<Function>(
-      new FfsFunction(*mainGadget, rr("ffs_main"), tmpMountpoint.c_str()));
-
-  auto configuration = new Configuration(*mainGadget, "c0");
-  configuration->addFunction(*ffs_function, "ffs_main");
-
-  ep0fd = open((tmpMountpoint / "ep0").c_str(), O_RDWR);
-  write_descriptors_accessory(ep0fd);
-  ep1fd = open((tmpMountpoint / "ep1").c_str(), O_RDWR);
-  ep2fd = open((tmpMountpoint / "ep2").c_str(), O_RDWR);
-
-  startThread(ep0fd, readWraper,
-              [=](auto &&... args) { return handleEp0Message(args...); });
-  startThread(
-      ep1fd, [=](auto &&... args) { return getMessage(args...); }, write);
-  startThread(ep2fd, readWraper,
-              [=](auto &&... args) { return handleMessage(args...); });
-
-  mainGadget->enable(udc);
+void AaCommunicator::start() {
+  ep0Connection = gadget.ep0Event.connect(
+      [this](const usb_functionfs_event &event) {
+        runGuarded([this, &event]() { handleEp0Event(event); });
+      });
+  // a headunit that is still connected from the last session is not
+  // enabled again
+  reactor.post([this]() {
+    runGuarded([this]() {
+      if (gadget.isEnabled())
+        startTransfers();
+    });
+  });
+  startThread([this]() { encryptPump(); });
+  startThread([this]() { decryptPump(); });
+  startThread([this]() { dispatchPump(); });
 }
 
-ssize_t AaCommunicator::readWraper(int fd, void *buf, size_t nbytes) {
-  struct timeval timeout {
-    1, 0
-  };
-
-  fd_set set;
-  FD_ZERO(&set);
-  FD_SET(fd, &set);
-
-  auto rv = select(fd + 1, &set, NULL, NULL, &timeout);
-  if (rv == -1) {
-    return -1l;
-  } else if (rv == 0) {
-    errno = EINTR;
-    return 0l;
-  } else
-    return read(fd, buf, nbytes); /* there was data to read */
+void AaCommunicator::startTransfers() {
+  // submitting to an endpoint that is not enabled would block the reactor
+  if (ep1Io)
+    return;
+  powerState = Active;
+  connectTimer.mark("usbEnable");
+  ep1Io = openEndpoint(gadget.ep1());
+  ep2Io = openEndpoint(gadget.ep2());
+  reactor.add(ep1Io->eventFd(), EPOLLIN, [this](uint32_t) {
+    runGuarded([this]() { writesCompleted(); });
+  });
+  reactor.add(ep2Io->eventFd(), EPOLLIN, [this](uint32_t) {
+    runGuarded([this]() { readsCompleted(); });
+  });
+  submitReads();
+  submitWrites();
 }
 
-void AaCommunicator::startThread(
-    int fd, std::function<ssize_t(int, void *, size_t)> readFun,
-    std::function<ssize_t(int, const void *, size_t)> writeFun) {
-  auto td = new ThreadDescriptor();
-  td->fd = fd;
-  td->readFun = readFun;
-  td->writeFun = writeFun;
-  td->endFun = [this](const std::exception &ex) { threadTerminated(ex); };
-  td->checkTerminate = [this]() { return threadFinished; };
-  threads.push_back(std::thread(&AaCommunicator::dataPump, td));
+std::unique_ptr<BulkEndpoint> AaCommunicator::openEndpoint(int fd) {
+  if (options.aioDepth == 0)
+    return make_unique<BlockingEndpoint>(fd);
+  return make_unique<AioEndpoint>(fd, options.aioDepth);
 }
 
-void AaCommunicator::dataPump(ThreadDescriptor *t) {
-  int bufSize = 100 * 1024;
-  char buffer[bufSize];
-
-  signal(SIGUSR1, [](int) {});
-
-  for (;;) {
+void AaCommunicator::startThread(std::function<void()> threadFun) {
+  threads.push_back(std::thread([this, threadFun]() {
     try {
-      auto length =
-          checkError(t->readFun(t->fd, buffer, bufSize), {EINTR, EAGAIN});
-      if (t->checkTerminate()) {
-        return;
-      }
-      auto start = 0;
-      while (length > 0) {
-        auto partLength =
-            checkError(t->writeFun(t->fd, (char *)buffer + start, length),
-                       {EINTR, EAGAIN});
-        if (t->checkTerminate()) {
-          return;
-        }
-        length -= partLength;
-        start += partLength;
-      }
+      threadFun();
     } catch (const std::exception &ex) {
-      t->endFun(ex);
-      break;
+      threadTerminated(ex);
     }
+  }));
+}
+
+void AaCommunicator::runGuarded(const std::function<void()> &fun) {
+  if (threadFinished)
+    return;
+  try {
+    fun();
+  } catch (const std::exception &ex) {
+    threadTerminated(ex);
   }
-  return;
+}
+
+void AaCommunicator::unregisterEndpoints() {
+  ep0Connection.disconnect();
+  if (ep1Io)
+    reactor.remove(ep1Io->eventFd());
+  if (ep2Io)
+    reactor.remove(ep2Io->eventFd());
 }
 
 void AaCommunicator::threadTerminated(const std::exception &ex) {
@@ -582,6 +1125,13 @@ void AaCommunicator::threadTerminated(const std::exception &ex) {
     threadFinished = true;
   }
   cv.notify_all();
+  budget.stop();
+  sendQueue.wake();
+  readyFrames.cancel();
+  receivedTransfers.cancel();
+  receivedMessages.cancel();
+  // completions would keep the eventfds readable
+  reactor.post([this]() { unregisterEndpoints(); });
   error(ex);
 }
 
@@ -590,21 +1140,47 @@ AaCommunicator::~AaCommunicator() {
     std::unique_lock<std::mutex> lk(m);
     threadFinished = true;
   }
-
-  // workaround for blocking read
-  for (auto &&th : threads) {
-    pthread_kill(th.native_handle(), SIGUSR1);
-  }
+  cv.notify_all();
+  budget.stop();
+  sendQueue.wake();
+  readyFrames.cancel();
+  receivedTransfers.cancel();
+  receivedMessages.cancel();
   for (auto &&th : threads) {
     th.join();
   }
+  // the pool goes on for other sessions, only this one's tasks are stopped
+  for (auto &executor : channelExecutors) {
+    if (executor)
+      executor->stop();
+  }
+  // no ep0 event is handled after this, so the reactor does not tell the
+  // handlers about suspend while they go away
+  reactor.call([this]() { ep0Connection.disconnect(); });
+  // their setup timers post to the executors; ~Timer takes the reactor
+  // mutex, so the handlers are deleted without holding channelsMutex
+  ChannelHandler *handlers[UINT8_MAX + 1];
+  {
+    std::unique_lock<std::mutex> lk(channelsMutex);
+    copy(begin(channelHandlers), end(channelHandlers), handlers);
+    fill_n(channelHandlers, UINT8_MAX + 1, nullptr);
+  }
+  for (auto handler : handlers)
+    delete handler;
+  // runs after everything the threads posted; destroying the endpoints
+  // cancels the transfers still in flight
+  reactor.call([this]() {
+    unregisterEndpoints();
+    ep1Io.reset();
+    ep2Io.reset();
+  });
+  // sessions that never got to show a picture are the interesting ones
+  reportConnectTiming();
 
-  if (ep2fd != -1)
-    close(ep2fd);
-  if (ep1fd != -1)
-    close(ep1fd);
-  if (ep0fd != -1)
-    close(ep0fd);
+  if (ssl)
+    SSL_free(ssl);
+  if (ctx)
+    SSL_CTX_free(ctx);
   if (pdumper)
     pcap_dump_close(pdumper);
   if (pd)
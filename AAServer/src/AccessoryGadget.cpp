@@ -0,0 +1,75 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "AccessoryGadget.h"
+#include "Configuration.h"
+#include "FfsFunction.h"
+#include "ServerUtils.h"
+#include "descriptors.h"
+#include "utils.h"
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+using namespace std;
+
+AccessoryGadget::AccessoryGadget(const Library &_lib, Reactor &_reactor,
+                                 int _udcId)
+    : lib(_lib), reactor(_reactor), udcId(_udcId) {
+  mainGadget = unique_ptr<Gadget>(new Gadget(
+      lib, 0x18d1, 0x2d00, udcInstanceName(rr("main_state"), udcId)));
+  mainGadget->setStrings("TAG", "AAServer", sr("TAGAAS"));
+
+  auto tmpMountpoint =
+      boost::filesystem::temp_directory_path() /
+      udcInstanceName(rr("AAServer_mp_loopback_main"), udcId);
+  create_directory(tmpMountpoint);
+  ffs_function = unique_ptr<Function>(
+      new FfsFunction(*mainGadget, udcInstanceName(rr("ffs_main"), udcId),
+                      tmpMountpoint.c_str()));
+
+  auto configuration = new Configuration(*mainGadget, "c0");
+  configuration->addFunction(*ffs_function, "ffs_main");
+
+  ep0fd = open((tmpMountpoint / "ep0").c_str(), O_RDWR);
+  write_descriptors_accessory(ep0fd);
+  ep1fd = open((tmpMountpoint / "ep1").c_str(), O_RDWR);
+  ep2fd = open((tmpMountpoint / "ep2").c_str(), O_RDWR);
+
+  reactor.add(ep0fd, EPOLLIN, [this](uint32_t) {
+    try {
+      ep0Readable();
+    } catch (const exception &ex) {
+      cout << "ep0: " << ex.what() << endl;
+    }
+  });
+}
+
+AccessoryGadget::~AccessoryGadget() {
+  if (ep0fd != -1)
+    reactor.remove(ep0fd);
+  if (ep2fd != -1)
+    close(ep2fd);
+  if (ep1fd != -1)
+    close(ep1fd);
+  if (ep0fd != -1)
+    close(ep0fd);
+}
+
+void AccessoryGadget::enable(const Udc &udc) { mainGadget->enable(udc); }
+
+void AccessoryGadget::ep0Readable() {
+  usb_functionfs_event events[4];
+  auto ret = checkError(read(ep0fd, events, sizeof(events)), {EINTR, EAGAIN});
+  for (ssize_t i = 0; i < ret / (ssize_t)sizeof(*events); ++i) {
+    cout << "udc " << udcId << " ep0 event " << (int)events[i].type << " "
+         << endl;
+    if (events[i].type == FUNCTIONFS_ENABLE)
+      enabled = true;
+    else if (events[i].type == FUNCTIONFS_DISABLE ||
+             events[i].type == FUNCTIONFS_UNBIND)
+      enabled = false;
+    ep0Event(events[i]);
+  }
+}
@@ -0,0 +1,119 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "AioEndpoint.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+// glibc has no wrappers for the native AIO syscalls
+static int io_setup(unsigned nr, aio_context_t *ctx) {
+  return syscall(__NR_io_setup, nr, ctx);
+}
+static int io_destroy(aio_context_t ctx) {
+  return syscall(__NR_io_destroy, ctx);
+}
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp) {
+  return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+static int io_getevents(aio_context_t ctx, long min_nr, long max_nr,
+                        struct io_event *events, struct timespec *timeout) {
+  return syscall(__NR_io_getevents, ctx, min_nr, max_nr, events, timeout);
+}
+
+AioEndpoint::AioEndpoint(int _fd, size_t depth)
+    : fd(_fd), maxInFlight(depth), iocbs(depth), iovs(depth), results(depth),
+      done(depth) {
+  efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (efd == -1)
+    throw runtime_error("eventfd failed: " + to_string(errno));
+  if (io_setup(depth, &ctx) < 0) {
+    close(efd);
+    throw runtime_error("io_setup failed: " + to_string(errno));
+  }
+}
+
+AioEndpoint::~AioEndpoint() {
+  // cancels and waits for whatever is still in flight
+  io_destroy(ctx);
+  close(efd);
+}
+
+void AioEndpoint::submit(struct iocb &cb) {
+  auto slot = submitted % maxInFlight;
+  cb.aio_data = submitted;
+  cb.aio_fildes = fd;
+  cb.aio_flags = IOCB_FLAG_RESFD;
+  cb.aio_resfd = efd;
+  done[slot] = false;
+  struct iocb *cbs[1] = {&cb};
+  int ret;
+  while ((ret = io_submit(ctx, 1, cbs)) < 0 && errno == EINTR) {
+  }
+  if (ret != 1)
+    throw runtime_error("io_submit failed: " + to_string(errno));
+  submitted++;
+}
+
+void AioEndpoint::submitRead(void *buffer, size_t size) {
+  if (inFlight() == maxInFlight)
+    throw runtime_error("AioEndpoint queue full");
+  auto &cb = iocbs[submitted % maxInFlight];
+  memset(&cb, 0, sizeof(cb));
+  cb.aio_lio_opcode = IOCB_CMD_PREAD;
+  cb.aio_buf = (__u64)buffer;
+  cb.aio_nbytes = size;
+  submit(cb);
+}
+
+void AioEndpoint::submitWrite(const struct iovec *iov, int count) {
+  if (inFlight() == maxInFlight)
+    throw runtime_error("AioEndpoint queue full");
+  auto slot = submitted % maxInFlight;
+  iovs[slot].assign(iov, iov + count);
+  auto &cb = iocbs[slot];
+  memset(&cb, 0, sizeof(cb));
+  cb.aio_lio_opcode = IOCB_CMD_PWRITEV;
+  cb.aio_buf = (__u64)iovs[slot].data();
+  cb.aio_nbytes = count;
+  submit(cb);
+}
+
+void AioEndpoint::reap() {
+  struct io_event events[maxInFlight];
+  struct timespec noWait = {0, 0};
+  int n = io_getevents(ctx, 0, maxInFlight, events, &noWait);
+  if (n < 0 && errno != EINTR)
+    throw runtime_error("io_getevents failed: " + to_string(errno));
+  for (int i = 0; i < n; ++i) {
+    auto slot = events[i].data % maxInFlight;
+    results[slot] = events[i].res;
+    done[slot] = true;
+  }
+}
+
+bool AioEndpoint::takeCompleted(ssize_t &result) {
+  auto slot = completed % maxInFlight;
+  if (inFlight() == 0 || !done[slot]) {
+    // completions after this reap signal the eventfd again; it is drained
+    // on every call that returns false so that it does not stay readable
+    uint64_t value;
+    while (read(efd, &value, sizeof(value)) > 0) {
+    }
+    if (inFlight() == 0)
+      return false;
+    reap();
+    if (!done[slot])
+      return false;
+  }
+  completed++;
+  if (results[slot] < 0)
+    throw runtime_error("AIO transfer failed: " + to_string(-results[slot]));
+  result = results[slot];
+  return true;
+}
@@ -0,0 +1,108 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "BlockingEndpoint.h"
+#include <cerrno>
+#include <cstdint>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+BlockingEndpoint::BlockingEndpoint(int _fd) : fd(_fd) {
+  efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (efd == -1)
+    throw runtime_error("eventfd failed: " + to_string(errno));
+  stopFd = eventfd(0, EFD_CLOEXEC);
+  if (stopFd == -1) {
+    close(efd);
+    throw runtime_error("eventfd failed: " + to_string(errno));
+  }
+  worker = thread([this]() { run(); });
+}
+
+BlockingEndpoint::~BlockingEndpoint() {
+  {
+    std::unique_lock<std::mutex> lk(m);
+    stopping = true;
+  }
+  cv.notify_all();
+  // wakes a worker waiting for the endpoint
+  uint64_t one = 1;
+  while (write(stopFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+  worker.join();
+  close(stopFd);
+  close(efd);
+}
+
+void BlockingEndpoint::run() {
+  std::unique_lock<std::mutex> lk(m);
+  while (true) {
+    cv.wait(lk, [this]() { return stopping || pending; });
+    if (stopping)
+      return;
+    pending = false;
+    lk.unlock();
+    struct pollfd fds[2] = {{fd, (short)(isWrite ? POLLOUT : POLLIN), 0},
+                            {stopFd, POLLIN, 0}};
+    while (poll(fds, 2, -1) < 0 && errno == EINTR) {
+    }
+    if (fds[1].revents)
+      return;
+    ssize_t ret;
+    do {
+      ret = isWrite ? writev(fd, iov.data(), iov.size())
+                    : read(fd, readBuffer, readSize);
+    } while (ret == -1 && errno == EINTR);
+    result = ret;
+    error = ret == -1 ? errno : 0;
+    done = true;
+    uint64_t one = 1;
+    while (write(efd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+    lk.lock();
+  }
+}
+
+void BlockingEndpoint::submit() {
+  done = false;
+  busy = true;
+  {
+    std::unique_lock<std::mutex> lk(m);
+    pending = true;
+  }
+  cv.notify_one();
+}
+
+void BlockingEndpoint::submitRead(void *buffer, size_t size) {
+  if (busy)
+    throw runtime_error("BlockingEndpoint queue full");
+  readBuffer = buffer;
+  readSize = size;
+  isWrite = false;
+  submit();
+}
+
+void BlockingEndpoint::submitWrite(const struct iovec *_iov, int count) {
+  if (busy)
+    throw runtime_error("BlockingEndpoint queue full");
+  iov.assign(_iov, _iov + count);
+  isWrite = true;
+  submit();
+}
+
+bool BlockingEndpoint::takeCompleted(ssize_t &_result) {
+  uint64_t value;
+  while (read(efd, &value, sizeof(value)) > 0) {
+  }
+  if (!busy || !done)
+    return false;
+  busy = false;
+  if (result < 0)
+    throw runtime_error("transfer failed: " + to_string(error));
+  _result = result;
+  return true;
+}
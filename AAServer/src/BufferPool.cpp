@@ -0,0 +1,35 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "BufferPool.h"
+#include <atomic>
+
+using namespace std;
+
+BufferPool::BufferPool(Counter &_allocations) : allocations(_allocations) {}
+
+shared_ptr<ByteBuffer> BufferPool::acquire(size_t size) {
+  size_t sizeClass = 0;
+  while (sizeClass < classCount &&
+         ((size_t)1 << (minClassShift + sizeClass)) < size)
+    sizeClass++;
+  if (sizeClass < classCount) {
+    for (auto &buffer : classes[sizeClass]) {
+      if (buffer.use_count() == 1) {
+        // pairs with the release done by whoever dropped the last reference
+        atomic_thread_fence(memory_order_acquire);
+        buffer->clear();
+        return buffer;
+      }
+    }
+  }
+  allocations.add();
+  auto buffer = make_shared<ByteBuffer>();
+  if (sizeClass == classCount) {
+    buffer->reserve(size);
+    return buffer;
+  }
+  buffer->reserve((size_t)1 << (minClassShift + sizeClass));
+  if (classes[sizeClass].size() < maxPooled)
+    classes[sizeClass].push_back(buffer);
+  return buffer;
+}
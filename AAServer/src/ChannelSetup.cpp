@@ -0,0 +1,106 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "ChannelSetup.h"
+#include <iostream>
+
+using namespace std;
+
+constexpr chrono::milliseconds ChannelSetup::timeout;
+
+ChannelSetup::ChannelSetup(Reactor &reactor, SerialExecutor &_executor,
+                           uint8_t _channelId, vector<Step> _steps,
+                           function<void(bool succeeded)> _finished)
+    : executor(_executor), channelId(_channelId), steps(std::move(_steps)),
+      finished(std::move(_finished)),
+      timer(reactor, [this]() { executor.post([this]() { timedOut(); }); }) {}
+
+ChannelSetup::State ChannelSetup::state() {
+  unique_lock<mutex> lk(m);
+  return currentState;
+}
+
+void ChannelSetup::start() {
+  function<void()> send;
+  {
+    unique_lock<mutex> lk(m);
+    if (currentState == Running)
+      return;
+    currentState = Running;
+    step = 0;
+    attempts = 0;
+    send = sendCurrentStep();
+  }
+  send();
+}
+
+void ChannelSetup::ensureStarted() {
+  {
+    unique_lock<mutex> lk(m);
+    if (currentState == Running || currentState == Done)
+      return;
+  }
+  start();
+}
+
+function<void()> ChannelSetup::sendCurrentStep() {
+  attempts++;
+  deadline = chrono::steady_clock::now() + timeout;
+  timer.start(timeout);
+  cout << "channel " << (int)channelId << ": " << steps[step].name
+       << " request, attempt " << attempts << endl;
+  return steps[step].sendRequest;
+}
+
+bool ChannelSetup::handleResponse(uint16_t messageType) {
+  function<void()> send;
+  bool done = false;
+  string completed;
+  {
+    unique_lock<mutex> lk(m);
+    if (currentState != Running || messageType != steps[step].responseType)
+      return false;
+    completed = steps[step].name;
+    if (++step < steps.size()) {
+      attempts = 0;
+      send = sendCurrentStep();
+    } else {
+      timer.cancel();
+      currentState = Done;
+      done = true;
+    }
+  }
+  stepCompleted(completed);
+  if (send)
+    send();
+  if (done)
+    finished(true);
+  return true;
+}
+
+void ChannelSetup::timedOut() {
+  function<void()> send;
+  bool failed = false;
+  {
+    unique_lock<mutex> lk(m);
+    if (currentState != Running)
+      return;
+    // the timer may have fired just before a response moved the setup on
+    auto now = chrono::steady_clock::now();
+    if (now < deadline) {
+      timer.start(chrono::duration_cast<chrono::milliseconds>(deadline - now));
+      return;
+    }
+    cout << "channel " << (int)channelId << ": no " << steps[step].name
+         << " response" << endl;
+    if (attempts < maxAttempts) {
+      send = sendCurrentStep();
+    } else {
+      currentState = Failed;
+      failed = true;
+    }
+  }
+  if (send)
+    send();
+  if (failed)
+    finished(false);
+}
@@ -20,11 +20,11 @@ bool DefaultChannelHandler::handleMessageFromHeadunit(const Message &message) {
 
 bool DefaultChannelHandler::handleMessageFromClient(
     int clientId, uint8_t channelId, bool specific,
-    const vector<uint8_t> &data) {
+    const SharedBuffer &data) {
   uint8_t flags = EncryptionType::Encrypted | FrameType::Bulk;
   if (specific) {
     flags |= MessageTypeFlags::Specific;
   }
-  sendToHeadunit(channelId, flags, data);
+  sendToHeadunit(OutgoingMessage(channelId, flags, data));
   return true;
 }
@@ -0,0 +1,80 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "FragmentSizeController.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+FragmentSizeController::FragmentSizeController(
+    size_t _fallback, size_t _target, chrono::milliseconds _probeTimeout)
+    : fallback(clamp(_fallback)), target(clamp(_target)), current(fallback),
+      probeTimeout(_probeTimeout) {}
+
+size_t FragmentSizeController::clamp(size_t size) {
+  return std::min(std::max(size, minSize), maxSize);
+}
+
+size_t FragmentSizeController::get() {
+  std::unique_lock<std::mutex> lk(m);
+  if (probing && probeSent &&
+      chrono::steady_clock::now() - probeWriteTime > probeTimeout) {
+    cout << "fragment size " << current
+         << " got no response from headunit, falling back to " << fallback
+         << endl;
+    probing = false;
+    current = fallback;
+  }
+  return current;
+}
+
+void FragmentSizeController::set(size_t size) {
+  std::unique_lock<std::mutex> lk(m);
+  current = clamp(size);
+  probing = false;
+  cout << "fragment size set to " << current << endl;
+}
+
+void FragmentSizeController::sessionReady() {
+  std::unique_lock<std::mutex> lk(m);
+  if (target <= current)
+    return;
+  current = target;
+  probing = true;
+  probeSent = false;
+  probeSample = 0;
+  cout << "probing fragment size " << current << endl;
+}
+
+bool FragmentSizeController::isProbe(size_t size) {
+  if (size <= fallback)
+    return false;
+  std::unique_lock<std::mutex> lk(m);
+  return probing && !probeSent;
+}
+
+bool FragmentSizeController::probeWritten(uint64_t sampleId) {
+  std::unique_lock<std::mutex> lk(m);
+  if (!probing || probeSent)
+    return false;
+  probeSent = true;
+  probeSample = sampleId;
+  probeWriteTime = chrono::steady_clock::now();
+  return true;
+}
+
+void FragmentSizeController::sampleAcked(uint64_t sampleId) {
+  std::unique_lock<std::mutex> lk(m);
+  if (probing && probeSample && sampleId >= probeSample) {
+    probing = false;
+    cout << "fragment size " << current << " confirmed by sample ack" << endl;
+  }
+}
+
+void FragmentSizeController::pingAnswered() {
+  std::unique_lock<std::mutex> lk(m);
+  if (probing && probeSent) {
+    probing = false;
+    cout << "fragment size " << current << " confirmed by ping" << endl;
+  }
+}
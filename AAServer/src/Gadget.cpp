@@ -37,3 +37,5 @@ usbg_gadget *Gadget::getGadget() const { return gadget; }
 void Gadget::enable(const Udc &udc) {
   checkUsbgError(usbg_enable_gadget(gadget, udc.getUdc()));
 }
+
+void Gadget::disable() { checkUsbgError(usbg_disable_gadget(gadget)); }
@@ -0,0 +1,24 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "H264.h"
+
+H264AccessUnit h264Parse(const uint8_t *data, size_t size) {
+  H264AccessUnit au;
+  for (size_t i = 0; i + 3 < size; ++i) {
+    if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+      continue;
+    auto header = data[i + 3];
+    auto type = header & 0x1f;
+    if (type == H264NalType::Sps || type == H264NalType::Pps)
+      au.parameterSets = true;
+    if (type >= H264NalType::NonIdrSlice && type <= H264NalType::IdrSlice) {
+      au.idr = type == H264NalType::IdrSlice;
+      au.reference = (header & 0x60) != 0;
+      return au;
+    }
+    i += 3;
+  }
+  // no slice found, treated as if it mattered
+  au.reference = true;
+  return au;
+}
@@ -0,0 +1,60 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "InitialGadget.h"
+#include "FfsFunction.h"
+#include "MassStorageFunction.h"
+#include "descriptors.h"
+#include "utils.h"
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// an existing LUN file of the right size is reused
+static void prepareLun(const string &path) {
+  const uintmax_t lunSize = 4 << 20;
+  boost::system::error_code ec;
+  if (boost::filesystem::file_size(path, ec) == lunSize && !ec)
+    return;
+  // sparse, nothing is written to the card
+  UniqueFd fd(open(path.c_str(), O_WRONLY | O_CREAT, 0644));
+  if (fd.get() == -1)
+    throw aa_runtime_error("cannot create " + path);
+  if (ftruncate(fd.get(), lunSize) != 0)
+    throw aa_runtime_error("cannot resize " + path);
+}
+
+InitialGadget::InitialGadget(const Library &lib, int udcId) {
+  auto lun0path = (boost::filesystem::temp_directory_path() /
+                   udcInstanceName(rr("lun0"), udcId));
+  prepareLun(lun0path.string());
+
+  gadget = make_unique<Gadget>(lib, 0x12d1, 0x107e,
+                               udcInstanceName(rr("initial_state"), udcId));
+  gadget->setStrings("TAG", "AAServer", sr("TAGAAS"));
+  ms_function = make_unique<MassStorageFunction>(
+      *gadget, udcInstanceName(rr("massstorage_initial"), udcId),
+      lun0path.c_str());
+
+  auto tmpMountpoint =
+      boost::filesystem::temp_directory_path() /
+      udcInstanceName(rr("AAServer_mp_loopback_initial"), udcId);
+  create_directory(tmpMountpoint);
+  ffs_function = make_unique<FfsFunction>(
+      *gadget, udcInstanceName(rr("ffs_initial"), udcId),
+      tmpMountpoint.c_str());
+
+  configuration = make_unique<Configuration>(*gadget, "c0");
+  configuration->addFunction(*ms_function, "massstorage_initial");
+  configuration->addFunction(*ffs_function, "loopback_initial");
+
+  ep0fd = UniqueFd(open((tmpMountpoint / "ep0").c_str(), O_RDWR));
+  if (ep0fd.get() == -1)
+    throw aa_runtime_error("cannot open initial ep0");
+  write_descriptors_default(ep0fd.get());
+}
+
+void InitialGadget::enable(const Udc &udc) { gadget->enable(udc); }
+
+void InitialGadget::disable() { gadget->disable(); }
@@ -2,6 +2,7 @@
 
 #include "InputChannelHandler.h"
 #include "InputChannel.pb.h"
+#include "MessageBuilder.h"
 #include "enums.h"
 #include "utils.h"
 #include <fmt/ranges.h>
@@ -13,46 +14,59 @@
 using namespace std;
 
 InputChannelHandler::InputChannelHandler(uint8_t channelId,
-                                         std::vector<int> availableButtons)
-    : ChannelHandler(channelId), available_buttons(availableButtons) {
+                                         std::vector<int> availableButtons,
+                                         Reactor &reactor,
+                                         SerialExecutor &executor)
+    : ChannelHandler(channelId), available_buttons(availableButtons),
+      setup(reactor, executor, channelId,
+            {channelOpenStep(),
+             {"Handshake", InputChannelMessageType::HandshakeResponse,
+              [this]() { sendHandshakeRequest(); }}},
+            [this](bool succeeded) { setupFinished(succeeded); }) {
   cout << "InputChannelHandler: " << (int)channelId << endl;
+  setup.stepCompleted.connect(
+      [this](const std::string &step) { phaseReached(step); });
 }
 InputChannelHandler::~InputChannelHandler() {}
 
+void InputChannelHandler::setupFinished(bool succeeded) {
+  std::unique_lock<std::mutex> lk(m);
+  if (!succeeded) {
+    cout << "input channel " << (int)channelId << " setup failed, dropping "
+         << pendingMessages.size() << " client messages" << endl;
+    pendingMessages.clear();
+    return;
+  }
+  channelReady = true;
+  for (auto &msg : pendingMessages)
+    sendToHeadunit(std::move(msg));
+  pendingMessages.clear();
+}
+
 void InputChannelHandler::sendHandshakeRequest() {
-  std::vector<uint8_t> plainMsg;
-  pushBackInt16(plainMsg, InputChannelMessageType::HandshakeRequest);
   tag::aas::InputChannelHandshakeRequest handshakeRequest;
   cout << fmt::format("Supported buttons ({}): {}", available_buttons.size(),
                       available_buttons)
        << endl;
   for (auto ab : available_buttons)
     handshakeRequest.add_available_buttons((tag::aas::ButtonCode_Enum)ab);
-  int bufSize = handshakeRequest.ByteSize();
-  uint8_t buffer[bufSize];
-  if (!handshakeRequest.SerializeToArray(buffer, bufSize))
-    throw aa_runtime_error("handshakeRequest.SerializeToArray failed");
-  copy(buffer, buffer + bufSize, std::back_inserter(plainMsg));
-  sendToHeadunit(channelId, FrameType::Bulk | EncryptionType::Encrypted,
-                 plainMsg);
-}
-
-void InputChannelHandler::expectHandshakeResponse() {
-  std::unique_lock<std::mutex> lk(m);
-  cv.wait(lk, [=] { return gotHandshakeResponse; });
+  MessageBuilder msg(channelId, FrameType::Bulk | EncryptionType::Encrypted,
+                     InputChannelMessageType::HandshakeRequest,
+                     handshakeRequest);
+  sendToHeadunit(msg.build());
 }
 
 bool InputChannelHandler::handleMessageFromHeadunit(const Message &message) {
+  const __u16 *shortView = (const __u16 *)(message.content->data());
+  auto messageType = be16_to_cpu(shortView[0]);
+  if (setup.handleResponse(messageType))
+    return true;
   if (ChannelHandler::handleMessageFromHeadunit(message))
     return true;
   bool messageHandled = false;
   {
     std::unique_lock<std::mutex> lk(m);
-    auto msg = message.content;
-    const __u16 *shortView = (const __u16 *)(msg.data());
-    auto messageType = be16_to_cpu(shortView[0]);
     if (messageType == InputChannelMessageType::HandshakeResponse) {
-      gotHandshakeResponse = true;
       messageHandled = true;
     } else if (messageType == InputChannelMessageType::Event) {
       for (auto &&rc : registered_clients)
@@ -60,22 +74,39 @@ bool InputChannelHandler::handleMessageFromHeadunit(const Message &message) {
       messageHandled = true;
     }
   }
-  cv.notify_all();
   return messageHandled;
 }
 
 bool InputChannelHandler::handleMessageFromClient(int clientId,
                                                   uint8_t channelId,
                                                   bool specific,
-                                                  const vector<uint8_t> &data) {
+                                                  const SharedBuffer &data) {
+  uint8_t flags = EncryptionType::Encrypted | FrameType::Bulk;
+  if (specific)
+    flags |= MessageTypeFlags::Specific;
+  std::unique_lock<std::mutex> lk(m);
   registered_clients.insert(clientId);
-  ChannelHandler::openChannel();
-  gotHandshakeResponse = false;
-  sendHandshakeRequest();
-  expectHandshakeResponse();
+  if (!channelReady) {
+    // the channel is opened once per session in the background, later
+    // subscribers only attach and get events as soon as it is up; a failed
+    // setup is started again by the next message
+    setup.ensureStarted();
+    if (data->empty())
+      return true;
+    if (pendingMessages.size() == maxPendingMessages) {
+      cout << "input channel " << (int)channelId
+           << " not ready, client message dropped" << endl;
+      return true;
+    }
+    pendingMessages.emplace_back(channelId, flags, data);
+    return true;
+  }
+  if (!data->empty())
+    sendToHeadunit(OutgoingMessage(channelId, flags, data));
   return true;
 }
 
 void InputChannelHandler::disconnected(int clientId) {
+  std::unique_lock<std::mutex> lk(m);
   registered_clients.erase(clientId);
 }
@@ -16,3 +16,13 @@ void ManualResetEvent::wait() {
   std::unique_lock<std::mutex> lk(m);
   cv.wait(lk, [this]() { return signaled; });
 }
+
+bool ManualResetEvent::waitFor(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lk(m);
+  return cv.wait_for(lk, timeout, [this]() { return signaled; });
+}
+
+void ManualResetEvent::reset() {
+  std::unique_lock<std::mutex> lk(m);
+  signaled = false;
+}
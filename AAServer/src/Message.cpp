@@ -2,4 +2,11 @@
 
 #include <Message.h>
 
-Message::Message() { offset = 0; }
+Message::Message() {}
+
+OutgoingMessage::OutgoingMessage(uint8_t _channel, uint8_t _flags,
+                                 SharedBuffer _content, size_t _headroom)
+    : channel(_channel), flags(_flags), content(std::move(_content)),
+      headroom(_headroom), offset(0),
+      enqueued(std::chrono::steady_clock::now()), droppable(false),
+      keyframe(false), reference(true), congested(false), sampleId(0) {}
@@ -0,0 +1,60 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "MessageBuilder.h"
+#include "enums.h"
+#include "utils.h"
+#include <cstring>
+#include <memory>
+
+MessageBuilder::MessageBuilder(uint8_t _channel, uint8_t _flags,
+                               uint16_t messageType, size_t payloadSize)
+    : channel(_channel), flags(_flags) {
+  buffer.reserve(headroom + sizeof(messageType) + payloadSize);
+  buffer.resize(headroom);
+  pushBackInt16(messageType);
+}
+
+MessageBuilder::MessageBuilder(uint8_t _channel, uint8_t _flags,
+                               uint16_t messageType,
+                               const google::protobuf::MessageLite &payload)
+    : MessageBuilder(_channel, _flags, messageType, payload.ByteSizeLong()) {
+  append(payload);
+}
+
+void MessageBuilder::pushBackInt16(uint16_t num) {
+  buffer.push_back(num >> 8);
+  buffer.push_back(num & 0xff);
+}
+
+void MessageBuilder::pushBackInt64(uint64_t num) {
+  for (int shift = 56; shift >= 0; shift -= 8)
+    buffer.push_back((num >> shift) & 0xff);
+}
+
+void MessageBuilder::append(const void *data, size_t size) {
+  auto offset = buffer.size();
+  buffer.resize(offset + size);
+  memcpy(buffer.data() + offset, data, size);
+}
+
+void MessageBuilder::append(const google::protobuf::MessageLite &payload) {
+  auto size = payload.ByteSizeLong();
+  auto offset = buffer.size();
+  buffer.resize(offset + size);
+  if (!payload.SerializeToArray(buffer.data() + offset, size))
+    throw aa_runtime_error("SerializeToArray failed");
+}
+
+OutgoingMessage MessageBuilder::build() {
+  if (!(flags & EncryptionType::Encrypted)) {
+    uint16_t length = buffer.size() - headroom;
+    auto header = buffer.data() + headroom - 4;
+    header[0] = channel;
+    header[1] = flags;
+    header[2] = (length >> 8);
+    header[3] = (length & 0xff);
+  }
+  return OutgoingMessage(channel, flags,
+                         std::make_shared<const ByteBuffer>(std::move(buffer)),
+                         headroom);
+}
@@ -1,25 +1,19 @@
 // Distributed under GPLv3 only as specified in repository's root LICENSE file
 
 #include "ModeSwitcher.h"
-#include "Configuration.h"
-#include "FfsFunction.h"
-#include "Function.h"
-#include "Gadget.h"
+#include "AccessoryGadget.h"
+#include "InitialGadget.h"
 #include "Library.h"
-#include "MassStorageFunction.h"
-#include "ModeSwitcher.h"
+#include "PhaseTimer.h"
 #include "Udc.h"
-#include "descriptors.h"
 #include "utils.h"
-#include <boost/filesystem.hpp>
-#include <boost/filesystem/operations.hpp>
-#include <fcntl.h>
 #include <iostream>
 #include <linux/usb/functionfs.h>
+#include <poll.h>
 #include <unistd.h>
 
 ssize_t ModeSwitcher::handleSwitchMessage(int fd, const void *buf,
-                                          size_t nbytes) {
+                                          size_t nbytes, PhaseTimer &timer) {
   const usb_functionfs_event *event = (const usb_functionfs_event *)buf;
   for (size_t n = nbytes / sizeof *event; n; --n, ++event) {
     if (event->type == FUNCTIONFS_SETUP) {
@@ -27,13 +21,19 @@ ssize_t ModeSwitcher::handleSwitchMessage(int fd, const void *buf,
       if (setup.bRequest == 51) {
         auto ret = write(fd, "\002\000", 2);
         std::cout << "Got 51, write=" << ret << std::endl;
+        timer.mark("aoaGetProtocol");
       } else if (setup.bRequest == 52) {
         std::cout << "Got some info: " << setup.wIndex << "=";
         if (setup.wLength < nbytes) {
           std::cout << std::endl;
         }
+        timer.mark("aoaString" + std::to_string(setup.wIndex));
       } else if (setup.bRequest == 53) {
-        std::cout << "Got 53, exit" << std::endl;
+        // no data stage; reading nothing completes the status stage, so the
+        // headunit sees the request succeed before the device goes away
+        auto ret = read(fd, nullptr, 0);
+        std::cout << "Got 53, ack=" << ret << std::endl;
+        timer.mark("aoaStart");
         return 0;
       }
     } else {
@@ -43,52 +43,46 @@ ssize_t ModeSwitcher::handleSwitchMessage(int fd, const void *buf,
   return nbytes;
 }
 
-void ModeSwitcher::handleSwitchToAccessoryMode(const Library &lib) {
-  Gadget initialGadget(lib, 0x12d1, 0x107e, rr("initial_state"));
-  initialGadget.setStrings("TAG", "AAServer", sr("TAGAAS"));
-
-  auto lun0path = (boost::filesystem::temp_directory_path() / rr("lun0"));
-  std::ofstream ofs(lun0path.c_str(), std::ios::binary | std::ios::out);
-  ofs.seekp((4 << 20) - 1);
-  ofs.write("", 1);
-  ofs.flush();
-  MassStorageFunction ms_function(initialGadget, rr("massstorage_initial"),
-                                  lun0path.c_str());
-
-  auto tmpMountpoint = boost::filesystem::temp_directory_path() /
-                       rr("AAServer_mp_loopback_initial");
-  create_directory(tmpMountpoint);
-  FfsFunction ffs_function(initialGadget, rr("ffs_initial"),
-                           tmpMountpoint.c_str());
-
-  Configuration configuration(initialGadget, "c0");
-  configuration.addFunction(ms_function, "massstorage_initial");
-  configuration.addFunction(ffs_function, "loopback_initial");
-
-  auto fd = open((tmpMountpoint / "ep0").c_str(), O_RDWR);
-  write_descriptors_default(fd);
-
-  auto udc = Udc::getUdcById(lib, 0);
-  initialGadget.enable(udc);
+bool ModeSwitcher::handleSwitchToAccessoryMode(const Library &lib,
+                                               InitialGadget &initial,
+                                               AccessoryGadget &accessory,
+                                               int udcId, int cancelFd) {
+  PhaseTimer timer("mode switch udc " + std::to_string(udcId));
+  auto udc = Udc::getUdcById(lib, udcId);
+  initial.enable(udc);
+  timer.mark("bindInitial");
 
+  auto fd = initial.ep0();
   auto eSize = sizeof(struct usb_functionfs_event);
   auto bufSize = 4 * eSize;
   uint8_t buffer[bufSize];
+  struct pollfd fds[2] = {{fd, POLLIN, 0}, {cancelFd, POLLIN, 0}};
   for (;;) {
-    std::cout << "pre read" << std::endl;
+    if (checkError(poll(fds, 2, -1), {EINTR}) <= 0)
+      continue;
+    if (fds[1].revents & POLLIN) {
+      std::cout << "mode switch udc " << udcId << " cancelled" << std::endl;
+      initial.disable();
+      return false;
+    }
+    if (!fds[0].revents)
+      continue;
     auto length = checkError(read(fd, buffer, bufSize), {EINTR, EAGAIN});
-    std::cout << "post read: " << length << std::endl;
     if (length == 0)
       continue;
     if (length == -1)
       break;
-    std::cout << "pre hSM" << std::endl;
-    checkError(handleSwitchMessage(fd, buffer, length), {EINTR, EAGAIN});
-    std::cout << "post hSM: " << length << std::endl;
-    if (length == -1)
+    // the headunit asked for accessory mode, no need to wait until it
+    // drops the device
+    if (checkError(handleSwitchMessage(fd, buffer, length, timer),
+                   {EINTR, EAGAIN}) == 0)
       break;
   }
-  std::cout << "pre close fd" << std::endl;
-  close(fd);
-  std::cout << "post close fd" << std::endl;
+
+  // the accessory gadget was prepared beforehand, switching is a re-bind
+  initial.disable();
+  accessory.enable(udc);
+  timer.mark("rebind");
+  timer.report(std::cout);
+  return true;
 }
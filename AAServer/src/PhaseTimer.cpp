@@ -0,0 +1,36 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "PhaseTimer.h"
+#include <fmt/core.h>
+
+using namespace std;
+
+PhaseTimer::PhaseTimer(const string &_name)
+    : name(_name), start(chrono::steady_clock::now()), last(start) {}
+
+void PhaseTimer::mark(const string &phase) {
+  auto now = chrono::steady_clock::now();
+  unique_lock<mutex> lk(m);
+  phases.push_back(
+      {phase, chrono::duration_cast<chrono::microseconds>(now - last).count(),
+       chrono::duration_cast<chrono::microseconds>(now - start).count()});
+  last = now;
+}
+
+void PhaseTimer::report(ostream &ostr) const {
+  unique_lock<mutex> lk(m);
+  string line = fmt::format("{{\"name\":\"{}\",\"phases\":[", name);
+  for (size_t i = 0; i < phases.size(); ++i) {
+    auto &phase = phases[i];
+    if (i > 0)
+      line += ",";
+    line += fmt::format("{{\"phase\":\"{}\",\"ms\":{:.1f},\"atMs\":{:.1f}}}",
+                        phase.name, phase.us / 1000.0, phase.atUs / 1000.0);
+  }
+  line += fmt::format(
+      "],\"totalMs\":{:.1f}}}",
+      chrono::duration_cast<chrono::microseconds>(last - start).count() /
+          1000.0);
+  lk.unlock();
+  ostr << "timing: " << line << endl;
+}
@@ -0,0 +1,172 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Reactor.h"
+#include "utils.h"
+#include <cerrno>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+Reactor::Reactor() {
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd == -1)
+    throw aa_runtime_error("epoll_create1 failed: " + to_string(errno));
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeFd == -1)
+    throw aa_runtime_error("eventfd failed: " + to_string(errno));
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = wakeFd;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakeFd, &ev) == -1)
+    throw aa_runtime_error("epoll_ctl failed: " + to_string(errno));
+  thread = std::thread([this]() { run(); });
+}
+
+Reactor::~Reactor() {
+  stop();
+  close(wakeFd);
+  close(epfd);
+}
+
+void Reactor::run() {
+  const int maxEvents = 16;
+  struct epoll_event events[maxEvents];
+  while (!stopping) {
+    auto n = epoll_wait(epfd, events, maxEvents, -1);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      throw aa_runtime_error("epoll_wait failed: " + to_string(errno));
+    }
+    for (int i = 0; i < n; ++i) {
+      auto fd = events[i].data.fd;
+      if (fd == wakeFd) {
+        uint64_t value;
+        while (read(wakeFd, &value, sizeof(value)) > 0) {
+        }
+        vector<function<void()>> funs;
+        {
+          unique_lock<mutex> lk(postedMutex);
+          funs.swap(posted);
+        }
+        unique_lock<recursive_mutex> lk(m);
+        for (auto &fun : funs) {
+          try {
+            fun();
+          } catch (const exception &ex) {
+            cout << "reactor task failed: " << ex.what() << endl;
+          }
+        }
+        removed.clear();
+        continue;
+      }
+      unique_lock<recursive_mutex> lk(m);
+      // the handler may have been removed by an earlier event of this round
+      auto it = handlers.find(fd);
+      if (it == handlers.end())
+        continue;
+      try {
+        it->second(events[i].events);
+      } catch (const exception &ex) {
+        cout << "reactor handler for fd " << fd << " failed: " << ex.what()
+             << endl;
+      }
+      removed.clear();
+    }
+  }
+}
+
+void Reactor::add(int fd, uint32_t events,
+                  function<void(uint32_t events)> handler) {
+  unique_lock<recursive_mutex> lk(m);
+  handlers[fd] = std::move(handler);
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    handlers.erase(fd);
+    throw aa_runtime_error("epoll_ctl add failed: " + to_string(errno));
+  }
+}
+
+void Reactor::modify(int fd, uint32_t events) {
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == -1)
+    throw aa_runtime_error("epoll_ctl mod failed: " + to_string(errno));
+}
+
+void Reactor::remove(int fd) {
+  unique_lock<recursive_mutex> lk(m);
+  epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+  auto it = handlers.find(fd);
+  if (it == handlers.end())
+    return;
+  // a handler may remove itself, it is destroyed after it returned
+  if (this_thread::get_id() == thread.get_id())
+    removed.push_back(std::move(it->second));
+  handlers.erase(it);
+}
+
+void Reactor::wake() {
+  uint64_t one = 1;
+  while (write(wakeFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+void Reactor::post(function<void()> fun) {
+  {
+    unique_lock<mutex> lk(postedMutex);
+    posted.push_back(std::move(fun));
+  }
+  wake();
+}
+
+void Reactor::call(function<void()> fun) {
+  if (this_thread::get_id() == thread.get_id()) {
+    fun();
+    return;
+  }
+  auto task = make_shared<packaged_task<void()>>(std::move(fun));
+  auto result = task->get_future();
+  bool queued;
+  {
+    unique_lock<mutex> lk(postedMutex);
+    queued = !stopped;
+    if (queued)
+      posted.push_back([task]() { (*task)(); });
+  }
+  // the loop is gone, nothing else touches the handlers any more
+  if (queued)
+    wake();
+  else
+    (*task)();
+  result.get();
+}
+
+void Reactor::stop() {
+  if (stopping.exchange(true))
+    return;
+  wake();
+  thread.join();
+  // tasks posted after the last round run here, call() may wait for them
+  vector<function<void()>> funs;
+  {
+    unique_lock<mutex> lk(postedMutex);
+    stopped = true;
+    funs.swap(posted);
+  }
+  for (auto &fun : funs) {
+    try {
+      fun();
+    } catch (const exception &ex) {
+      cout << "reactor task failed: " << ex.what() << endl;
+    }
+  }
+}
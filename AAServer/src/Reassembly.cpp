@@ -0,0 +1,31 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Reassembly.h"
+#include "utils.h"
+#include <fmt/core.h>
+
+using namespace std;
+
+void Reassembly::start(BufferPool &pool, uint8_t _flags, size_t size) {
+  // an unfinished message is dropped, the headunit started over
+  if (size > maxMessageSize)
+    throw aa_runtime_error(fmt::format("message too long: {}", size));
+  flags = _flags;
+  buffer = pool.acquire(size);
+  // ByteBuffer leaves the new bytes as they are, fragments overwrite them
+  buffer->resize(size);
+  filled = 0;
+  active = true;
+}
+
+void Reassembly::commit(size_t size) {
+  if (size > freeSize())
+    throw aa_runtime_error("fragment longer than announced message");
+  filled += size;
+}
+
+SharedBuffer Reassembly::finish() {
+  active = false;
+  buffer->resize(filled);
+  return std::move(buffer);
+}
@@ -0,0 +1,77 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "SendBudget.h"
+#include <algorithm>
+
+using namespace std;
+
+SendBudget::SendBudget(size_t _channelLimit, size_t _totalLimit)
+    : channelLimit(_channelLimit), totalLimit(_totalLimit) {
+  for (auto &bytes : channelBytes)
+    bytes = 0;
+}
+
+bool SendBudget::exceeded(uint8_t channel, size_t size) const {
+  auto channelQueued = channelBytes[channel].load();
+  if (channelQueued == 0)
+    return false;
+  return channelQueued + size > channelLimit ||
+         totalBytes.load() + size > totalLimit;
+}
+
+size_t SendBudget::excess(uint8_t channel) const {
+  auto channelQueued = channelBytes[channel].load();
+  auto total = totalBytes.load();
+  size_t ret = 0;
+  if (channelQueued > channelLimit)
+    ret = channelQueued - channelLimit;
+  if (total > totalLimit)
+    ret = std::max(ret, std::min(channelQueued, total - totalLimit));
+  return ret;
+}
+
+bool SendBudget::waitForSpace(uint8_t channel, size_t size) {
+  waiters.fetch_add(1);
+  bool fits;
+  {
+    std::unique_lock<std::mutex> lk(m);
+    cv.wait(lk, [&]() {
+      return suspended || stopped || !exceeded(channel, size);
+    });
+    fits = !suspended && !stopped;
+  }
+  waiters.fetch_sub(1);
+  return fits;
+}
+
+void SendBudget::setSuspended(bool suspend) {
+  {
+    std::unique_lock<std::mutex> lk(m);
+    suspended = suspend;
+  }
+  cv.notify_all();
+}
+
+void SendBudget::stop() {
+  {
+    std::unique_lock<std::mutex> lk(m);
+    stopped = true;
+  }
+  cv.notify_all();
+}
+
+void SendBudget::add(uint8_t channel, size_t size) {
+  channelBytes[channel].fetch_add(size);
+  totalBytes.fetch_add(size);
+}
+
+void SendBudget::release(uint8_t channel, size_t size) {
+  channelBytes[channel].fetch_sub(size);
+  totalBytes.fetch_sub(size);
+  if (waiters.load() > 0) {
+    std::unique_lock<std::mutex> lk(m);
+    cv.notify_all();
+  }
+}
+
+size_t SendBudget::queued() const { return totalBytes.load(); }
@@ -0,0 +1,92 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "SendScheduler.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+SendScheduler::SendScheduler() {
+  for (auto &priority : priorities)
+    priority = ControlPriority;
+}
+
+void SendScheduler::setPriority(uint8_t channel, SendPriority priority) {
+  priorities[channel] = priority;
+}
+
+SendPriority SendScheduler::getPriority(uint8_t channel) const {
+  return (SendPriority)priorities[channel].load();
+}
+
+void SendScheduler::push(OutgoingMessage &&msg) {
+  auto channel = msg.channel;
+  auto &queue = queues[channel];
+  queue.push_back(std::move(msg));
+  queuedMessages++;
+  if (queue.size() == 1)
+    readyChannels[getPriority(channel)].push_back(channel);
+}
+
+bool SendScheduler::empty() const { return queuedMessages == 0; }
+
+size_t SendScheduler::size() const { return queuedMessages; }
+
+OutgoingMessage &SendScheduler::front() {
+  for (int p = 0; p < PriorityCount; ++p) {
+    if (!readyChannels[p].empty()) {
+      currentPriority = p;
+      return queues[readyChannels[p].front()].front();
+    }
+  }
+  throw runtime_error("SendScheduler::front on empty scheduler");
+}
+
+void SendScheduler::fragmentSent() {
+  if (currentPriority < 0)
+    throw runtime_error("SendScheduler::fragmentSent without front");
+  auto &ready = readyChannels[currentPriority];
+  auto channel = ready.front();
+  auto &queue = queues[channel];
+  ready.pop_front();
+  auto &msg = queue.front();
+  if (msg.offset >= msg.payloadSize()) {
+    queue.pop_front();
+    queuedMessages--;
+  }
+  if (!queue.empty())
+    ready.push_back(channel);
+  currentPriority = -1;
+}
+
+void SendScheduler::drop(
+    uint8_t channel, size_t bytes, size_t keep,
+    const function<void(const OutgoingMessage &)> &dropped) {
+  auto &queue = queues[channel];
+  if (queue.size() <= keep)
+    return;
+  size_t freed = 0;
+  auto end = queue.size() - keep;
+  auto it = queue.begin();
+  if (it->offset > 0) {
+    ++it;
+    --end;
+  }
+  for (size_t i = 0; i < end && freed < bytes; ++i) {
+    if (!it->droppable) {
+      ++it;
+      continue;
+    }
+    freed += it->payloadSize();
+    dropped(*it);
+    it = queue.erase(it);
+    queuedMessages--;
+  }
+  if (queue.empty()) {
+    for (auto &ready : readyChannels) {
+      auto pos = std::find(ready.begin(), ready.end(), channel);
+      if (pos != ready.end())
+        ready.erase(pos);
+    }
+  }
+}
@@ -13,3 +13,7 @@ void checkUsbgError(int returnValue) {
                         usbg_strerror((usbg_error)returnValue));
   }
 }
+
+string udcInstanceName(const string &name, int udcId) {
+  return udcId == 0 ? name : name + to_string(udcId);
+}
@@ -3,60 +3,85 @@
 #include "SocketClient.h"
 #include "utils.h"
 #include <asm-generic/errno.h>
+#include <cerrno>
 #include <cstddef>
+#include <iostream>
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 using namespace std;
 
-SocketClient::SocketClient(int _fd) : fd(_fd) {}
+SocketClient::SocketClient(Reactor &_reactor, WorkerPool &pool, int _fd)
+    : reactor(_reactor), executor(pool), fd(_fd), buffer(2 * 1024 * 1024) {}
 
 SocketClient::~SocketClient() {
-  clientThreadCancel = true;
-  clientThread.join();
+  // after the resume tasks this client posted
+  reactor.call([this]() { reactor.remove(fd); });
   close(fd);
 }
 
 void SocketClient::ready() {
-  clientThread = std::thread([this]() {
-    try {
-      clientThreadMethod();
-    } catch (exception &ex) {
-      close(fd);
-    }
-  });
+  reactor.add(fd, EPOLLIN, [this](uint32_t) { readable(); });
 }
 
-void SocketClient::clientThreadMethod() {
-  int bufSize = 2 * 1024 * 1024;
-  uint8_t buffer[bufSize];
-  for (;;) {
-    struct timeval timeout {
-      1, 0
-    };
+void SocketClient::disconnect() { shutdown(fd, SHUT_RDWR); }
 
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(fd, &set);
-
-    auto rv = select(fd + 1, &set, NULL, NULL, &timeout);
-    if (clientThreadCancel) {
-      break;
-    }
-    if (rv <= 0)
-      continue;
+void SocketClient::readable() {
+  auto ret = read(fd, buffer.data(), buffer.size());
+  if (ret == -1 && (errno == EINTR || errno == EAGAIN))
+    return;
+  if (ret <= 0) {
+    closed = true;
+    reactor.remove(fd);
+    executor.post([this]() { disconnected(); });
+    return;
+  }
+  // every packet starts with type, channel and specific; anything shorter
+  // is a protocol error and ends the client like a failed handler does
+  if (ret < 3) {
+    cout << "client sent a packet of " << ret << " bytes, disconnecting"
+         << endl;
+    closed = true;
+    reactor.remove(fd);
+    shutdown(fd, SHUT_RDWR);
+    executor.post([this]() { disconnected(); });
+    return;
+  }
+  Packet p;
+  p.packetType = (PacketType)buffer[0];
+  p.channelNumber = buffer[1];
+  p.specific = buffer[2];
+  p.data = make_shared<const ByteBuffer>(buffer.data() + 3,
+                                        buffer.data() + ret);
+  if (++pending == maxPending) {
+    paused = true;
+    reactor.remove(fd);
+  }
+  executor.post([this, p]() { handlePacket(p); });
+}
 
-    auto ret = read(fd, buffer, bufSize);
-    if (ret == 0) {
-      disconnected();
-      break;
-    } else {
-      Packet p;
-      p.packetType = (PacketType)buffer[0];
-      p.channelNumber = buffer[1];
-      p.specific = buffer[2];
-      copy(buffer + 3, buffer + ret, back_inserter(p.data));
+void SocketClient::handlePacket(const Packet &p) {
+  if (!failed) {
+    try {
       gotPacket(p);
+    } catch (exception &ex) {
+      failed = true;
+      closed = true;
+      reactor.remove(fd);
+      shutdown(fd, SHUT_RDWR);
     }
   }
+  if (--pending == maxPending / 2)
+    reactor.post([this]() { resume(); });
+}
+
+void SocketClient::resume() {
+  if (!paused || closed || pending >= maxPending)
+    return;
+  paused = false;
+  ready();
 }
 
 void SocketClient::sendMessage(const std::vector<uint8_t> &msg) {
@@ -70,3 +95,18 @@ void SocketClient::sendMessage(const std::vector<uint8_t> &msg) {
     }
   }
 }
+
+void SocketClient::sendMessage(const std::vector<uint8_t> &header,
+                               const ByteBuffer &payload) {
+  struct iovec iov[2] = {{(void *)header.data(), header.size()},
+                         {(void *)payload.data(), payload.size()}};
+  auto ret = writev(fd, iov, 2);
+  if (ret != header.size() + payload.size()) {
+    if (ret == -1 && errno == ECONNRESET) {
+      throw client_disconnected_error();
+    } else {
+      throw runtime_error("sendMessage failed: " + to_string(ret) +
+                          " errno=" + to_string(errno));
+    }
+  }
+}
@@ -1,73 +1,79 @@
 // Distributed under GPLv3 only as specified in repository's root LICENSE file
 
 #include "SocketCommunicator.h"
+#include <cstring>
 #include <iostream>
 #include <iterator>
 #include <mutex>
 #include <stdexcept>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <unistd.h>
 
 using namespace std;
 
-SocketCommunicator::SocketCommunicator(std::string _path) : path(_path) {
-  listenThread = std::thread([this]() { listenThreadMethod(); });
-}
-
-void SocketCommunicator::listenThreadMethod() {
+SocketCommunicator::SocketCommunicator(Reactor &_reactor, std::string _path,
+                                       size_t clientThreads)
+    : reactor(_reactor), clientPool(clientThreads), path(_path) {
   struct sockaddr_un server;
 
-  sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
   if (sock < 0) {
     throw runtime_error("opening stream socket");
   }
   server.sun_family = AF_UNIX;
   strcpy(server.sun_path, path.c_str());
   if (bind(sock, (struct sockaddr *)&server, sizeof(struct sockaddr_un))) {
+    close(sock);
     throw runtime_error("bind failed");
   }
   listen(sock, 5);
-  for (;;) {
-    struct timeval timeout {
-      1, 0
-    };
-
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(sock, &set);
+  reactor.add(sock, EPOLLIN, [this](uint32_t) { acceptClient(); });
+}
 
-    auto rv = select(sock + 1, &set, NULL, NULL, &timeout);
-    if (listenThreadCancel) {
-      break;
+void SocketCommunicator::acceptClient() {
+  SocketClient *client = nullptr;
+  try {
+    auto msgsock = accept(sock, 0, 0);
+    if (msgsock == -1) {
+      throw runtime_error("accept failed");
     }
-    if (rv <= 0)
-      continue;
-    SocketClient *client = nullptr;
-    try {
-      auto msgsock = accept(sock, 0, 0);
-      if (msgsock == -1) {
-        throw runtime_error("accept failed");
-      }
-      client = new SocketClient(msgsock);
+    client = new SocketClient(reactor, clientPool, msgsock);
+    {
+      unique_lock<mutex> lk(clientsMutex);
       clients.insert(client);
-      client->disconnected.connect([&, client]() { clients.erase(client); });
-      newClient(client);
-      client->ready();
-    } catch (const exception &ex) {
-      if (client)
-        delete client;
-    } catch (...) {
-      if (client)
-        delete client;
     }
+    client->disconnected.connect([&, client]() {
+      unique_lock<mutex> lk(clientsMutex);
+      clients.erase(client);
+    });
+    newClient(client);
+    client->ready();
+  } catch (const exception &ex) {
+    if (client)
+      delete client;
+  } catch (...) {
+    if (client)
+      delete client;
+  }
+}
+
+void SocketCommunicator::disconnectClients(
+    function<bool(SocketClient *)> filter) {
+  unique_lock<mutex> lk(clientsMutex);
+  for (auto &client : clients) {
+    if (filter(client))
+      client->disconnect();
   }
 }
 
 SocketCommunicator::~SocketCommunicator() {
-  listenThreadCancel = true;
-  listenThread.join();
+  reactor.remove(sock);
   close(sock);
   unlink(path.c_str());
+  // no handler runs any more once the pool stopped
+  clientPool.stop();
   for (auto &client : clients)
     delete client;
 }
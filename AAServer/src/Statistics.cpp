@@ -0,0 +1,40 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Statistics.h"
+#include <fmt/core.h>
+
+using namespace std;
+
+Statistics::Statistics() : lastReport(chrono::steady_clock::now()) {}
+
+Counter &Statistics::get(const string &name, bool monotonic) {
+  std::unique_lock<std::mutex> lk(m);
+  auto &entry = entries[name];
+  entry.monotonic = monotonic;
+  return entry.counter;
+}
+
+Counter &Statistics::counter(const string &name) { return get(name, true); }
+
+Counter &Statistics::gauge(const string &name) { return get(name, false); }
+
+void Statistics::report(ostream &ostr) {
+  std::unique_lock<std::mutex> lk(m);
+  auto now = chrono::steady_clock::now();
+  auto seconds = chrono::duration<double>(now - lastReport).count();
+  lastReport = now;
+  string line = "{";
+  for (auto &[name, entry] : entries) {
+    auto value = entry.counter.get();
+    if (line.size() > 1)
+      line += ",";
+    line += fmt::format("\"{}\":{}", name, value);
+    if (entry.monotonic && seconds > 0) {
+      line += fmt::format(",\"{}/s\":{:.1f}", name,
+                          (value - entry.lastValue) / seconds);
+    }
+    entry.lastValue = value;
+  }
+  line += "}";
+  ostr << "stats: " << line << std::endl;
+}
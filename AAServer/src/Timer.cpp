@@ -0,0 +1,45 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "Timer.h"
+#include "utils.h"
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+Timer::Timer(Reactor &_reactor, function<void()> _expired)
+    : reactor(_reactor), expired(std::move(_expired)) {
+  fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd == -1)
+    throw aa_runtime_error("timerfd_create failed: " + to_string(errno));
+  reactor.add(fd, EPOLLIN, [this](uint32_t) {
+    uint64_t expirations;
+    // nothing to read when the timer was re-armed after it fired
+    if (read(fd, &expirations, sizeof(expirations)) > 0)
+      expired();
+  });
+}
+
+Timer::~Timer() {
+  reactor.remove(fd);
+  close(fd);
+}
+
+void Timer::start(chrono::milliseconds timeout) {
+  struct itimerspec spec = {};
+  auto ns = chrono::duration_cast<chrono::nanoseconds>(timeout).count();
+  spec.it_value.tv_sec = ns / 1000000000;
+  spec.it_value.tv_nsec = ns % 1000000000;
+  // a zero it_value would disarm the timer
+  if (ns <= 0)
+    spec.it_value.tv_nsec = 1;
+  if (timerfd_settime(fd, 0, &spec, nullptr) == -1)
+    throw aa_runtime_error("timerfd_settime failed: " + to_string(errno));
+}
+
+void Timer::cancel() {
+  struct itimerspec spec = {};
+  timerfd_settime(fd, 0, &spec, nullptr);
+}
@@ -3,14 +3,17 @@
 #include "Udc.h"
 #include "Library.h"
 #include <stdexcept>
+#include <string>
 
 using namespace std;
 
 Udc::Udc(usbg_udc *udc) : udc(udc) {}
 Udc Udc::getUdcById(const Library &lib, int id) {
-  if (id != 0)
-    throw runtime_error("Only id==0 supported");
   auto udc = usbg_get_first_udc(lib.getState());
+  for (int i = 0; udc && i < id; ++i)
+    udc = usbg_get_next_udc(udc);
+  if (!udc)
+    throw runtime_error("no UDC with id " + to_string(id));
   return udc;
 }
 usbg_udc *Udc::getUdc() const { return udc; }
@@ -2,6 +2,10 @@
 
 #include "VideoChannelHandler.h"
 #include "ChannelHandler.h"
+#include "H264.h"
+#include "MediaAckIndication.pb.h"
+#include "MediaChannelSetupResponse.pb.h"
+#include "MessageBuilder.h"
 #include "enums.h"
 #include "utils.h"
 #include <boost/range/algorithm/max_element.hpp>
@@ -17,7 +21,6 @@ using namespace std;
 
 GstFlowReturn VideoChannelHandler::new_sample(GstElement *sink,
                                               VideoChannelHandler *_this) {
-  static bool firstSample = true;
   GstSample *sample;
   g_signal_emit_by_name(sink, "pull-sample", &sample);
   if (!sample) {
@@ -26,42 +29,168 @@ GstFlowReturn VideoChannelHandler::new_sample(GstElement *sink,
   }
   auto buffer = gst_sample_get_buffer(sample);
 
-  vector<uint8_t> msgToHeadunit;
-  if (firstSample) {
-    _this->openChannel();
-  }
-  if (buffer->pts == -1) {
-    pushBackInt16(msgToHeadunit, MediaMessageType::MediaIndication);
-  } else {
-    pushBackInt16(msgToHeadunit,
-                  MediaMessageType::MediaWithTimestampIndication);
-    pushBackInt64(msgToHeadunit, buffer->pts / 1000);
-  }
+  // the setup runs in the background, this streaming thread never waits
+  // for the headunit
+  _this->channelOpened = true;
+  _this->setup.ensureStarted();
   GstMapInfo map;
   gst_buffer_map(buffer, &map, GST_MAP_READ);
-  copy(map.data, map.data + map.size, back_inserter(msgToHeadunit));
+  bool timestamped = buffer->pts != -1;
+  MessageBuilder msg(_this->channelId,
+                     EncryptionType::Encrypted | FrameType::Bulk,
+                     timestamped ? MediaMessageType::MediaWithTimestampIndication
+                                 : MediaMessageType::MediaIndication,
+                     (timestamped ? sizeof(uint64_t) : 0) + map.size);
+  if (timestamped)
+    msg.pushBackInt64(buffer->pts / 1000);
+  msg.append(map.data, map.size);
+  auto au = h264Parse(map.data, map.size);
   gst_buffer_unmap(buffer, &map);
-  _this->sendToHeadunit(_this->channelId,
-                        EncryptionType::Encrypted | FrameType::Bulk,
-                        msgToHeadunit);
+  _this->handleSample(msg.build(), au);
 
   gst_sample_unref(sample);
-  firstSample = false;
   return GST_FLOW_OK;
 }
 
+void VideoChannelHandler::handleSample(OutgoingMessage msg,
+                                       const H264AccessUnit &au) {
+  auto keyframe = au.idr;
+  std::unique_lock<std::mutex> lk(sampleMutex);
+  if (streaming) {
+    if (!waitForCredit()) {
+      windowOverruns.add();
+      msg.congested = true;
+    }
+    sendSample(std::move(msg));
+    return;
+  }
+  // a newer keyframe makes the pending samples useless
+  if (keyframe)
+    pendingSamples.clear();
+  if (pendingSamples.empty() && !keyframe)
+    return;
+  if (pendingSamples.size() == maxPendingSamples) {
+    pendingSamples.clear();
+    return;
+  }
+  pendingSamples.push_back(std::move(msg));
+}
+
+void VideoChannelHandler::setupFinished(bool succeeded) {
+  std::unique_lock<std::mutex> lk(sampleMutex);
+  if (!succeeded) {
+    cout << "video channel " << (int)channelId << " setup failed" << endl;
+    pendingSamples.clear();
+    return;
+  }
+  streaming = true;
+  // acks are handled on this thread, there is no waiting for credit here
+  for (auto &msg : pendingSamples) {
+    std::unique_lock<std::mutex> creditLock(creditMutex);
+    if (!hasCredit()) {
+      windowOverruns.add();
+      msg.congested = true;
+    }
+    creditLock.unlock();
+    sendSample(std::move(msg));
+  }
+  pendingSamples.clear();
+}
+
+bool VideoChannelHandler::hasCredit() const {
+  return maxUnacked == 0 || unacked.size() < maxUnacked;
+}
+
+bool VideoChannelHandler::waitForCredit() {
+  std::unique_lock<std::mutex> lk(creditMutex);
+  if (hasCredit())
+    return true;
+  if (windowPolicy != BlockPolicy)
+    return false;
+  auto start = chrono::steady_clock::now();
+  creditAvailable.wait(
+      lk, [this]() { return hasCredit() || suspended || stopping; });
+  windowWaitUs.add(chrono::duration_cast<chrono::microseconds>(
+                       chrono::steady_clock::now() - start)
+                       .count());
+  return hasCredit() && !suspended && !stopping;
+}
+
+void VideoChannelHandler::sendSample(OutgoingMessage msg) {
+  // charged before sending, the encrypting thread may drop the sample and
+  // give the credit back before sendToHeadunit returns
+  auto id = msg.sampleId = ++lastSampleId;
+  {
+    std::unique_lock<std::mutex> lk(creditMutex);
+    unacked.push_back({id, chrono::steady_clock::now()});
+    inFlight.set(unacked.size());
+    inFlightMax.max(unacked.size());
+  }
+  if (!sendToHeadunit(std::move(msg))) {
+    // the headunit never gets it, so it is never acked
+    releaseCredit(id);
+    return;
+  }
+  if (!sampleSent) {
+    sampleSent = true;
+    firstSampleSent();
+  }
+}
+
+void VideoChannelHandler::releaseCredit(uint64_t sampleId) {
+  {
+    std::unique_lock<std::mutex> lk(creditMutex);
+    // gone already if a focus change reset the window in between
+    for (auto it = unacked.begin(); it != unacked.end(); ++it) {
+      if (it->id == sampleId) {
+        unacked.erase(it);
+        break;
+      }
+    }
+    inFlight.set(unacked.size());
+  }
+  creditAvailable.notify_all();
+}
+
+void VideoChannelHandler::messageDropped(const OutgoingMessage &message) {
+  if (message.sampleId != 0)
+    releaseCredit(message.sampleId);
+}
+
 static void error_cb(GstBus *bus, GstMessage *msg, VideoChannelHandler *_this) {
   cout << "ERROR" << endl;
 }
 
-VideoChannelHandler::VideoChannelHandler(uint8_t channelId)
-    : ChannelHandler(channelId) {
+VideoChannelHandler::VideoChannelHandler(uint8_t channelId,
+                                         const string &socketPath,
+                                         OverloadPolicy _windowPolicy,
+                                         Statistics &statistics,
+                                         Reactor &reactor,
+                                         SerialExecutor &executor)
+    : ChannelHandler(channelId), channelOpened(false),
+      setup(reactor, executor, channelId,
+            {channelOpenStep(),
+             {"Setup", MediaMessageType::SetupResponse,
+              [this]() { sendSetupRequest(); }}},
+            [this](bool succeeded) { setupFinished(succeeded); }),
+      windowPolicy(_windowPolicy),
+      maxUnackedGauge(statistics.gauge("video.maxUnacked")),
+      inFlight(statistics.gauge("video.inFlight")),
+      inFlightMax(statistics.gauge("video.inFlightMax")),
+      acks(statistics.counter("video.acks")),
+      ackRttUs(statistics.counter("video.ackRttUs")),
+      ackRttMaxUs(statistics.gauge("video.ackRttMaxUs")),
+      windowOverruns(statistics.counter("video.windowOverruns")),
+      windowWaitUs(statistics.counter("video.windowWaitUs")),
+      keyframeRequests(statistics.counter("video.keyframeRequests")) {
   cout << "VideoChannelHandler: " << (int)channelId << endl;
-  channelOpened = false;
+  setup.stepCompleted.connect(
+      [this](const std::string &step) { phaseReached(step); });
 
   pipeline = gst_pipeline_new("main-pipeline");
 
   auto app_sink = gst_element_factory_make("appsink", "app_sink");
+  appSink = app_sink;
   g_object_set(app_sink, "emit-signals", TRUE, NULL);
   g_signal_connect(app_sink, "new-sample", G_CALLBACK(new_sample), this);
 
@@ -88,7 +217,7 @@ VideoChannelHandler::VideoChannelHandler(uint8_t channelId)
   g_object_set(capsfilter_pre, "caps", rawcaps, NULL);
 
   auto shmsrc = gst_element_factory_make("shmsrc", "shmsrc");
-  g_object_set(G_OBJECT(shmsrc), "socket-path", "/tmp/aacs_mixer", NULL);
+  g_object_set(G_OBJECT(shmsrc), "socket-path", socketPath.c_str(), NULL);
   g_object_set(G_OBJECT(shmsrc), "is-live", TRUE, NULL);
   g_object_set(G_OBJECT(shmsrc), "do-timestamp", TRUE, NULL);
   auto queue_snowmix = gst_element_factory_make("queue", "queue_snowmix");
@@ -122,42 +251,122 @@ VideoChannelHandler::VideoChannelHandler(uint8_t channelId)
   gst_element_set_state(pipeline, GST_STATE_PLAYING);
 }
 
-VideoChannelHandler::~VideoChannelHandler() {}
-
-void VideoChannelHandler::openChannel() {
-  channelOpened = true;
-  ChannelHandler::openChannel();
-  gotSetupResponse = false;
-  sendSetupRequest();
-  expectSetupResponse();
+VideoChannelHandler::~VideoChannelHandler() {
+  {
+    std::unique_lock<std::mutex> lk(creditMutex);
+    stopping = true;
+  }
+  creditAvailable.notify_all();
+  // waits for the streaming thread, new_sample is not called any more
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
 }
 
 void VideoChannelHandler::disconnected(int clientId) {
 }
 
+void VideoChannelHandler::setSuspended(bool suspend) {
+  if (suspend) {
+    {
+      std::unique_lock<std::mutex> lk(creditMutex);
+      suspended = true;
+    }
+    // a streaming thread waiting for credit would keep the pipeline playing
+    creditAvailable.notify_all();
+    {
+      std::unique_lock<std::mutex> lk(sampleMutex);
+      pendingSamples.clear();
+    }
+    // the source is live, in PAUSED nothing is captured or encoded
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    cout << "video channel " << (int)channelId << " suspended" << endl;
+  } else {
+    {
+      std::unique_lock<std::mutex> lk(creditMutex);
+      suspended = false;
+    }
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    // the stream goes on where it paused, but the headunit may have dropped
+    // its decoder state while the link was down
+    requestKeyframe();
+  }
+}
+
+void VideoChannelHandler::requestKeyframe() {
+  keyframeRequests.add();
+  // what gst_video_event_new_upstream_force_key_unit builds, without
+  // linking gstreamer-video
+  auto event = gst_event_new_custom(
+      GST_EVENT_CUSTOM_UPSTREAM,
+      gst_structure_new("GstForceKeyUnit", "running-time", G_TYPE_UINT64,
+                        GST_CLOCK_TIME_NONE, "all-headers", G_TYPE_BOOLEAN,
+                        TRUE, "count", G_TYPE_UINT, 0, NULL));
+  if (!gst_element_send_event(appSink, event))
+    cout << "video channel " << (int)channelId << ": keyframe request failed"
+         << endl;
+}
+
 void VideoChannelHandler::sendSetupRequest() {
-  std::vector<uint8_t> plainMsg;
-  pushBackInt16(plainMsg, MediaMessageType::SetupRequest);
-  plainMsg.push_back(0x08);
-  plainMsg.push_back(0x03);
-  sendToHeadunit(channelId, FrameType::Bulk | EncryptionType::Encrypted,
-                 plainMsg);
+  const uint8_t setupRequest[] = {0x08, 0x03};
+  MessageBuilder msg(channelId, FrameType::Bulk | EncryptionType::Encrypted,
+                     MediaMessageType::SetupRequest, sizeof(setupRequest));
+  msg.append(setupRequest, sizeof(setupRequest));
+  sendToHeadunit(msg.build());
+}
+
+void VideoChannelHandler::handleSetupResponse(const uint8_t *buf,
+                                              size_t nbytes) {
+  tag::aas::MediaChannelSetupResponse response;
+  if (!response.ParseFromArray(buf, nbytes))
+    return;
+  std::unique_lock<std::mutex> lk(creditMutex);
+  maxUnacked = response.max_unacked();
+  maxUnackedGauge.set(maxUnacked);
+  cout << "video channel " << (int)channelId << " max unacked " << maxUnacked
+       << endl;
 }
 
-void VideoChannelHandler::expectSetupResponse() {
-  std::unique_lock<std::mutex> lk(m);
-  cv.wait(lk, [=] { return gotSetupResponse; });
+void VideoChannelHandler::handleAck(const uint8_t *buf, size_t nbytes) {
+  tag::aas::MediaAckIndication ack;
+  if (!ack.ParseFromArray(buf, nbytes))
+    return;
+  auto now = chrono::steady_clock::now();
+  uint64_t lastAcked = 0;
+  {
+    std::unique_lock<std::mutex> lk(creditMutex);
+    // acks of samples sent before a focus change are not counted
+    for (uint32_t i = 0; i < ack.ack() && !unacked.empty(); ++i) {
+      auto rtt = chrono::duration_cast<chrono::microseconds>(
+                     now - unacked.front().sent)
+                     .count();
+      ackRttUs.add(rtt);
+      ackRttMaxUs.max(rtt);
+      acks.add();
+      lastAcked = unacked.front().id;
+      unacked.pop_front();
+    }
+    inFlight.set(unacked.size());
+  }
+  creditAvailable.notify_all();
+  if (lastAcked)
+    sampleAcked(lastAcked);
 }
 
 void VideoChannelHandler::sendStartIndication() {
-  std::vector<uint8_t> plainMsg;
-  pushBackInt16(plainMsg, MediaMessageType::StartIndication);
-  plainMsg.push_back(0x08);
-  plainMsg.push_back(0x00);
-  plainMsg.push_back(0x10);
-  plainMsg.push_back(0x00);
-  sendToHeadunit(channelId, FrameType::Bulk | EncryptionType::Encrypted,
-                 plainMsg);
+  {
+    // the headunit starts counting again
+    std::unique_lock<std::mutex> lk(creditMutex);
+    unacked.clear();
+    inFlight.set(0);
+  }
+  creditAvailable.notify_all();
+
+  const uint8_t startIndication[] = {0x08, 0x00, 0x10, 0x00};
+  MessageBuilder msg(channelId, FrameType::Bulk | EncryptionType::Encrypted,
+                     MediaMessageType::StartIndication,
+                     sizeof(startIndication));
+  msg.append(startIndication, sizeof(startIndication));
+  sendToHeadunit(msg.build());
 }
 
 bool VideoChannelHandler::handleMessageFromHeadunit(const Message &message) {
@@ -167,32 +376,35 @@ bool VideoChannelHandler::handleMessageFromHeadunit(const Message &message) {
                                  message.content);
     return true;
   }
+  const __u16 *shortView = (const __u16 *)(message.content->data());
+  auto messageType = be16_to_cpu(shortView[0]);
+  auto payload = message.content->data() + sizeof(__u16);
+  auto payloadSize = message.content->size() - sizeof(__u16);
+  // the window has to be known when the setup finishes
+  if (messageType == MediaMessageType::SetupResponse)
+    handleSetupResponse(payload, payloadSize);
+  if (setup.handleResponse(messageType))
+    return true;
   if (ChannelHandler::handleMessageFromHeadunit(message))
     return true;
   bool messageHandled = false;
-  {
-    std::unique_lock<std::mutex> lk(m);
-    auto msg = message.content;
-    const __u16 *shortView = (const __u16 *)(msg.data());
-    auto messageType = be16_to_cpu(shortView[0]);
-    if (messageType == MediaMessageType::SetupResponse) {
-      gotSetupResponse = true;
-      messageHandled = true;
-    } else if (messageType == MediaMessageType::VideoFocusIndication) {
-      sendStartIndication();
-      messageHandled = true;
-    } else if (messageType == MediaMessageType::MediaAckIndication) {
-      messageHandled = true;
-    }
+  if (messageType == MediaMessageType::SetupResponse) {
+    messageHandled = true;
+  } else if (messageType == MediaMessageType::VideoFocusIndication) {
+    phaseReached("VideoFocus");
+    sendStartIndication();
+    messageHandled = true;
+  } else if (messageType == MediaMessageType::MediaAckIndication) {
+    handleAck(payload, payloadSize);
+    messageHandled = true;
   }
-  cv.notify_all();
   return messageHandled;
 }
 
 bool VideoChannelHandler::handleMessageFromClient(int clientId,
                                                   uint8_t channelId,
                                                   bool specific,
-                                                  const vector<uint8_t> &data) {
+                                                  const SharedBuffer &data) {
   // Video is routed through snowmix
   return false;
 }
@@ -0,0 +1,127 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "WorkerPool.h"
+#include <algorithm>
+
+using namespace std;
+
+WorkerPool::WorkerPool(size_t threadCount) {
+  for (size_t i = 0; i < threadCount; ++i)
+    threads.push_back(thread([this]() { run(); }));
+}
+
+void WorkerPool::run() {
+  for (;;) {
+    SerialExecutor *executor;
+    PoolShare *share;
+    {
+      unique_lock<mutex> lk(m);
+      auto next = ready.end();
+      cv.wait(lk, [&]() {
+        if (stopping)
+          return true;
+        next = find_if(ready.begin(), ready.end(), [](SerialExecutor *e) {
+          return !e->share || e->share->running < e->share->limit;
+        });
+        return next != ready.end();
+      });
+      if (stopping)
+        return;
+      executor = *next;
+      ready.erase(next);
+      share = executor->share;
+      if (share)
+        share->running++;
+    }
+    executor->runOne();
+    if (share) {
+      {
+        unique_lock<mutex> lk(m);
+        share->running--;
+      }
+      // an executor of this share may be waiting in the queue
+      cv.notify_one();
+    }
+  }
+}
+
+void WorkerPool::schedule(SerialExecutor *executor) {
+  {
+    unique_lock<mutex> lk(m);
+    ready.push_back(executor);
+  }
+  cv.notify_one();
+}
+
+void WorkerPool::setShare(SerialExecutor *executor, PoolShare *share) {
+  {
+    unique_lock<mutex> lk(m);
+    executor->share = share;
+  }
+  cv.notify_one();
+}
+
+void WorkerPool::stop() {
+  {
+    unique_lock<mutex> lk(m);
+    if (stopping)
+      return;
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto &th : threads)
+    th.join();
+}
+
+WorkerPool::~WorkerPool() { stop(); }
+
+SerialExecutor::SerialExecutor(WorkerPool &_pool, PoolShare *_share)
+    : pool(_pool), share(_share) {}
+
+void SerialExecutor::post(function<void()> task) {
+  {
+    unique_lock<mutex> lk(m);
+    if (stopped)
+      return;
+    tasks.push_back(std::move(task));
+    if (scheduled)
+      return;
+    scheduled = true;
+  }
+  pool.schedule(this);
+}
+
+void SerialExecutor::stop() {
+  unique_lock<mutex> lk(m);
+  stopped = true;
+  tasks.clear();
+  cv.wait(lk, [this]() { return !scheduled; });
+}
+
+void SerialExecutor::runOne() {
+  function<void()> task;
+  {
+    unique_lock<mutex> lk(m);
+    if (tasks.empty()) {
+      // stopped while it was waiting for a thread
+      scheduled = false;
+      cv.notify_all();
+      return;
+    }
+    task = std::move(tasks.front());
+    tasks.pop_front();
+  }
+  task();
+  // its captures may belong to the owner, which can go away once stop()
+  // returned
+  task = nullptr;
+  {
+    unique_lock<mutex> lk(m);
+    if (tasks.empty()) {
+      scheduled = false;
+      cv.notify_all();
+      return;
+    }
+  }
+  pool.schedule(this);
+}
@@ -0,0 +1,79 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "BlockingEndpoint.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+static void check(bool condition, const char *what) {
+  if (condition)
+    return;
+  cerr << "FAILED: " << what << endl;
+  exit(1);
+}
+
+// waits for the eventfd like the reactor does
+static bool signalled(const BulkEndpoint &endpoint, int timeoutMs) {
+  struct pollfd pfd = {endpoint.eventFd(), POLLIN, 0};
+  return poll(&pfd, 1, timeoutMs) == 1;
+}
+
+// a pipe stands in for the FunctionFS endpoints, it blocks the same way
+static void transfers() {
+  int fds[2];
+  check(pipe(fds) == 0, "pipe");
+  BlockingEndpoint writer(fds[1]);
+  BlockingEndpoint reader(fds[0]);
+  check(writer.depth() == 1, "one transfer at a time");
+
+  char in[16] = {};
+  reader.submitRead(in, sizeof(in));
+  check(reader.inFlight() == 1, "read in flight");
+  ssize_t ret;
+  check(!signalled(reader, 50), "read blocks without data");
+  check(!reader.takeCompleted(ret), "nothing completed yet");
+
+  char a[] = "abc", b[] = "def";
+  struct iovec iov[2] = {{a, 3}, {b, 3}};
+  writer.submitWrite(iov, 2);
+  check(signalled(writer, 1000), "write signalled");
+  check(writer.takeCompleted(ret) && ret == 6, "whole write completed");
+  check(writer.inFlight() == 0, "write taken");
+  check(!signalled(writer, 0), "eventfd drained");
+
+  check(signalled(reader, 1000), "read signalled");
+  check(reader.takeCompleted(ret) && ret == 6, "read completed");
+  check(memcmp(in, "abcdef", 6) == 0, "read what was written");
+  check(!reader.takeCompleted(ret), "completion is taken once");
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// a transfer that waits for data does not keep the endpoint from going away
+static void interrupted() {
+  int fds[2];
+  check(pipe(fds) == 0, "pipe");
+  auto start = chrono::steady_clock::now();
+  {
+    BlockingEndpoint reader(fds[0]);
+    char in[16];
+    reader.submitRead(in, sizeof(in));
+    this_thread::sleep_for(chrono::milliseconds(20));
+  }
+  check(chrono::steady_clock::now() - start < chrono::seconds(5),
+        "destructor wakes a waiting read");
+  close(fds[0]);
+  close(fds[1]);
+}
+
+int main() {
+  transfers();
+  interrupted();
+  cout << "BlockingEndpointTest passed" << endl;
+}
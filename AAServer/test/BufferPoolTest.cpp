@@ -0,0 +1,96 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "BufferPool.h"
+#include "SharedBuffer.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+// every heap allocation made by the test, not only the pool misses
+static atomic<size_t> heapAllocations{0};
+
+void *operator new(size_t size) {
+  heapAllocations.fetch_add(1, memory_order_relaxed);
+  if (auto p = malloc(size ? size : 1))
+    return p;
+  throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static void check(bool condition, const char *what) {
+  if (condition)
+    return;
+  cerr << "FAILED: " << what << endl;
+  exit(1);
+}
+
+// what Reassembly does with one message: take a buffer, size it to the
+// announced length, write the fragments into it and pass it on
+static SharedBuffer receive(BufferPool &pool, size_t size, uint8_t fill) {
+  auto buffer = pool.acquire(size);
+  buffer->resize(size);
+  memset(buffer->data(), fill, size);
+  return buffer;
+}
+
+// once every size class was used, receiving allocates nothing
+static void steadyState() {
+  Counter misses;
+  BufferPool pool(misses);
+  const size_t sizes[] = {16, 1000, 5000, 100000, 600000};
+  for (auto size : sizes)
+    receive(pool, size, 1);
+  auto missesBefore = misses.get();
+  auto allocationsBefore = heapAllocations.load();
+  for (int round = 0; round < 1000; ++round) {
+    for (auto size : sizes) {
+      auto message = receive(pool, size, 2);
+      check(message->size() == size, "message has the announced size");
+    }
+  }
+  check(misses.get() == missesBefore, "no pool misses in steady state");
+  check(heapAllocations.load() == allocationsBefore,
+        "no heap allocations in steady state");
+}
+
+// a message that is still referenced is not handed out again
+static void heldBuffers() {
+  Counter misses;
+  BufferPool pool(misses);
+  auto first = receive(pool, 100, 1);
+  auto second = receive(pool, 100, 2);
+  check(first != second, "held buffer is not reused");
+  check((*first)[0] == 1 && (*second)[0] == 2, "held buffers keep content");
+  auto data = first->data();
+  first.reset();
+  auto third = receive(pool, 100, 3);
+  check(third->data() == data, "released buffer is reused");
+  check(misses.get() == 2, "only the first two buffers were pool misses");
+}
+
+// growing a recycled buffer leaves the old bytes in place instead of
+// clearing them, the caller overwrites them anyway
+static void noClear() {
+  Counter misses;
+  BufferPool pool(misses);
+  receive(pool, 4000, 0xab);
+  auto buffer = pool.acquire(4000);
+  check(buffer->empty(), "acquired buffer is empty");
+  buffer->resize(4000);
+  check((*buffer)[0] == 0xab && (*buffer)[3999] == 0xab,
+        "resize does not clear the bytes");
+}
+
+int main() {
+  steadyState();
+  heldBuffers();
+  noClear();
+  cout << "BufferPoolTest passed" << endl;
+}
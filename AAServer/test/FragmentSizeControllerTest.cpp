@@ -0,0 +1,106 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "FragmentSizeController.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+static void check(bool condition, const char *what) {
+  if (condition)
+    return;
+  cerr << "FAILED: " << what << endl;
+  exit(1);
+}
+
+static const chrono::milliseconds timeout(50);
+
+// only the ack of the probed sample or a later one confirms the size
+static void earlierAck() {
+  FragmentSizeController c(2000, 16384, timeout);
+  check(c.get() == 2000, "fallback before the session is ready");
+  c.sessionReady();
+  check(c.get() == 16384, "target while probing");
+  check(!c.isProbe(1000), "small fragment is no probe");
+  check(c.isProbe(16384), "large fragment is a probe");
+  // acks of earlier samples, sent in small fragments
+  c.sampleAcked(4);
+  check(c.probeWritten(5), "first probe written");
+  check(!c.isProbe(16384), "one probe at a time");
+  check(!c.probeWritten(6), "later frames are no probe");
+  c.sampleAcked(4);
+  this_thread::sleep_for(timeout * 2);
+  check(c.get() == 2000, "ack of an earlier sample does not confirm");
+}
+
+static void confirmed() {
+  FragmentSizeController c(2000, 16384, timeout);
+  c.sessionReady();
+  c.probeWritten(5);
+  c.sampleAcked(6);
+  this_thread::sleep_for(timeout * 2);
+  check(c.get() == 16384, "ack of the probed sample confirms");
+  check(!c.isProbe(16384), "no probe once confirmed");
+}
+
+// until the probe was written on the bus there is nothing to time out
+static void notWrittenYet() {
+  FragmentSizeController c(2000, 16384, timeout);
+  c.sessionReady();
+  this_thread::sleep_for(timeout * 2);
+  check(c.get() == 16384, "no fallback before the probe was written");
+  c.sampleAcked(10);
+  check(c.isProbe(16384), "ack before the probe was written is ignored");
+}
+
+// without video the probe times out on its own
+static void noVideo() {
+  FragmentSizeController c(2000, 16384, timeout);
+  c.sessionReady();
+  c.pingAnswered();
+  check(c.isProbe(16384), "ping before the probe was written is ignored");
+  check(c.probeWritten(0), "probe of a non-video message");
+  c.sampleAcked(100);
+  this_thread::sleep_for(timeout * 2);
+  check(c.get() == 2000, "unanswered probe falls back without video");
+}
+
+static void pingConfirms() {
+  FragmentSizeController c(2000, 16384, timeout);
+  c.sessionReady();
+  c.probeWritten(0);
+  c.pingAnswered();
+  this_thread::sleep_for(timeout * 2);
+  check(c.get() == 16384, "ping response confirms");
+
+  FragmentSizeController video(2000, 16384, timeout);
+  video.sessionReady();
+  video.probeWritten(5);
+  video.pingAnswered();
+  this_thread::sleep_for(timeout * 2);
+  check(video.get() == 16384, "ping response confirms a video probe");
+}
+
+// a new session probes again
+static void newSession() {
+  FragmentSizeController c(2000, 16384, timeout);
+  c.sessionReady();
+  c.probeWritten(1);
+  this_thread::sleep_for(timeout * 2);
+  check(c.get() == 2000, "timed out probe falls back");
+  c.sessionReady();
+  check(c.get() == 16384, "next session probes again");
+  check(c.isProbe(16384), "next session waits for its own probe");
+}
+
+int main() {
+  earlierAck();
+  confirmed();
+  notWrittenYet();
+  noVideo();
+  pingConfirms();
+  newSession();
+  cout << "FragmentSizeControllerTest passed" << endl;
+}
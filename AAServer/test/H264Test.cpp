@@ -0,0 +1,81 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "H264.h"
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static void check(bool condition, const char *what) {
+  if (condition)
+    return;
+  cerr << "FAILED: " << what << endl;
+  exit(1);
+}
+
+static H264AccessUnit parse(const vector<uint8_t> &data) {
+  return h264Parse(data.data(), data.size());
+}
+
+static void startCodes() {
+  auto three = parse({0x00, 0x00, 0x01, 0x65, 0x88, 0x84});
+  check(three.idr, "IDR after a 3-byte start code");
+  check(three.reference, "IDR is a reference");
+  check(!three.parameterSets, "no parameter sets in a lone IDR");
+
+  auto four = parse({0x00, 0x00, 0x00, 0x01, 0x41, 0x9a, 0x02});
+  check(!four.idr, "non-IDR slice after a 4-byte start code");
+  check(four.reference, "nal_ref_idc 2 is a reference");
+
+  auto disposable = parse({0x00, 0x00, 0x00, 0x01, 0x01, 0x9e, 0x10});
+  check(!disposable.idr, "non-IDR slice");
+  check(!disposable.reference, "nal_ref_idc 0 is no reference");
+}
+
+// without a slice the frame is kept as if later ones depended on it
+static void noSlice() {
+  auto missing = parse({0x65, 0x88, 0x84, 0x00, 0x10});
+  check(!missing.idr, "no IDR without a start code");
+  check(missing.reference, "missing start code counts as reference");
+  check(!missing.parameterSets, "no parameter sets without a start code");
+
+  auto empty = parse({});
+  check(empty.reference, "empty access unit counts as reference");
+
+  // start code at the very end, the NAL header was cut off
+  auto cut = parse({0x00, 0x00, 0x00, 0x01});
+  check(!cut.idr, "no IDR in a cut off NAL");
+  check(cut.reference, "cut off NAL counts as reference");
+
+  // SPS header followed by a start code whose slice header is missing
+  auto truncated = parse({0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x00, 0x01});
+  check(truncated.parameterSets, "SPS before the truncated NAL is seen");
+  check(!truncated.idr, "no IDR in a truncated NAL");
+  check(truncated.reference, "truncated NAL counts as reference");
+}
+
+static void parameterSetsAndIdr() {
+  auto au = parse({// access unit delimiter
+                   0x00, 0x00, 0x00, 0x01, 0x09, 0xf0,
+                   // SPS, its payload holds 0x65 which is no NAL header
+                   0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x1f, 0x65, 0x40,
+                   // PPS
+                   0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x3c, 0x80,
+                   // SEI
+                   0x00, 0x00, 0x01, 0x06, 0x05, 0x01, 0x80,
+                   // IDR slice
+                   0x00, 0x00, 0x01, 0x65, 0x88, 0x84, 0x00, 0x2b,
+                   // non-IDR slice of the next frame is not looked at
+                   0x00, 0x00, 0x01, 0x01, 0x9e});
+  check(au.idr, "IDR after SPS and PPS");
+  check(au.reference, "IDR after SPS and PPS is a reference");
+  check(au.parameterSets, "SPS and PPS are seen");
+}
+
+int main() {
+  startCodes();
+  noSlice();
+  parameterSetsAndIdr();
+  cout << "H264Test passed" << endl;
+}
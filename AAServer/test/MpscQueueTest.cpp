@@ -0,0 +1,115 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "MpscQueue.h"
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static void check(bool condition, const char *what) {
+  if (condition)
+    return;
+  cerr << "FAILED: " << what << endl;
+  exit(1);
+}
+
+struct Item {
+  int producer;
+  size_t sequence;
+};
+
+// a small queue goes around many times, each cell is reused
+static void wrapAround() {
+  MpscQueue<Item> queue(4);
+  size_t next = 0;
+  for (size_t round = 0; round < 1000; ++round) {
+    for (size_t i = 0; i < 3; ++i) {
+      Item item{0, round * 3 + i};
+      check(queue.tryPush(item), "push into a queue with free cells");
+    }
+    for (size_t i = 0; i < 3; ++i) {
+      auto item = queue.pop();
+      check(item.has_value(), "pop what was pushed");
+      check(item->sequence == next++, "fifo order across wrap-around");
+    }
+    check(queue.empty(), "empty after popping everything");
+    check(!queue.pop(), "nothing to pop from an empty queue");
+  }
+}
+
+static void full() {
+  MpscQueue<Item> queue(8);
+  for (size_t i = 0; i < 8; ++i) {
+    Item item{0, i};
+    check(queue.tryPush(item), "push up to capacity");
+  }
+  Item item{0, 8};
+  check(!queue.tryPush(item), "push into a full queue fails");
+  check(item.sequence == 8, "failed push leaves the value alone");
+  check(queue.pop()->sequence == 0, "oldest first");
+  check(queue.tryPush(item), "push after a pop");
+  for (size_t i = 1; i <= 8; ++i)
+    check(queue.pop()->sequence == i, "order after refilling");
+  check(queue.empty(), "drained");
+}
+
+// producers contend for a queue much smaller than what they push, the
+// consumer sleeps whenever it runs dry; items of one producer keep their
+// order and none is lost or duplicated
+static void producersKeepOrder() {
+  const int producerCount = 4;
+  const size_t perProducer = 200000;
+  MpscQueue<Item> queue(64);
+  vector<thread> producers;
+  for (int p = 0; p < producerCount; ++p) {
+    producers.emplace_back([&queue, p]() {
+      for (size_t i = 0; i < perProducer; ++i) {
+        Item item{p, i};
+        while (!queue.tryPush(item))
+          this_thread::yield();
+      }
+    });
+  }
+  vector<size_t> next(producerCount, 0);
+  size_t received = 0;
+  while (received < producerCount * perProducer) {
+    auto item = queue.pop();
+    if (!item) {
+      queue.wait(-1);
+      continue;
+    }
+    check(item->producer >= 0 && item->producer < producerCount,
+          "known producer");
+    check(item->sequence == next[item->producer]++,
+          "per-producer order, nothing lost or duplicated");
+    received++;
+  }
+  for (auto &producer : producers)
+    producer.join();
+  check(queue.empty(), "nothing left behind");
+  for (int p = 0; p < producerCount; ++p)
+    check(next[p] == perProducer, "every item of every producer");
+}
+
+// wake() ends a wait without anything pushed
+static void wake() {
+  MpscQueue<Item> queue(4);
+  thread waker([&queue]() {
+    this_thread::sleep_for(chrono::milliseconds(10));
+    queue.wake();
+  });
+  queue.wait(-1);
+  waker.join();
+  check(!queue.pop(), "woken without an item");
+}
+
+int main() {
+  wrapAround();
+  full();
+  producersKeepOrder();
+  wake();
+  cout << "MpscQueueTest passed" << endl;
+  return 0;
+}
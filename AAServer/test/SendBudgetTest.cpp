@@ -0,0 +1,65 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "SendBudget.h"
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+
+using namespace std;
+
+static void check(bool condition, const char *what) {
+  if (condition)
+    return;
+  cerr << "FAILED: " << what << endl;
+  exit(1);
+}
+
+// a full channel, the next message of 100 bytes has to wait
+static void fill(SendBudget &budget) { budget.add(1, 1000); }
+
+static future<bool> waiter(SendBudget &budget) {
+  auto fits =
+      async(launch::async, [&]() { return budget.waitForSpace(1, 100); });
+  check(fits.wait_for(50ms) == future_status::timeout, "waits while full");
+  return fits;
+}
+
+static void released() {
+  SendBudget budget(1000, 10000);
+  fill(budget);
+  auto fits = waiter(budget);
+  budget.release(1, 500);
+  check(fits.wait_for(5s) == future_status::ready, "woken by release");
+  check(fits.get(), "fits after release");
+}
+
+static void suspended() {
+  SendBudget budget(1000, 10000);
+  fill(budget);
+  auto fits = waiter(budget);
+  budget.setSuspended(true);
+  check(fits.wait_for(5s) == future_status::ready, "woken by suspend");
+  check(!fits.get(), "gives up while suspended");
+  check(!budget.waitForSpace(1, 100), "does not wait while suspended");
+  budget.setSuspended(false);
+  fits = waiter(budget);
+  budget.release(1, 1000);
+  check(fits.get(), "waits again after resume");
+}
+
+static void stopped() {
+  SendBudget budget(1000, 10000);
+  fill(budget);
+  auto fits = waiter(budget);
+  budget.stop();
+  check(fits.wait_for(5s) == future_status::ready, "woken by stop");
+  check(!fits.get(), "gives up when stopped");
+}
+
+int main() {
+  released();
+  suspended();
+  stopped();
+  cout << "SendBudgetTest passed" << endl;
+}
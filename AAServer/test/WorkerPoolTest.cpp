@@ -0,0 +1,143 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include "WorkerPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static void check(bool condition, const char *what) {
+  if (condition)
+    return;
+  cerr << "FAILED: " << what << endl;
+  exit(1);
+}
+
+// stands in for a headunit that stopped reading, tasks block until opened
+class Gate {
+  mutex m;
+  condition_variable cv;
+  bool open = false;
+
+public:
+  void wait() {
+    unique_lock<mutex> lk(m);
+    cv.wait(lk, [this]() { return open; });
+  }
+  void release() {
+    {
+      unique_lock<mutex> lk(m);
+      open = true;
+    }
+    cv.notify_all();
+  }
+};
+
+static bool waitUntil(const atomic<int> &value, int expected) {
+  auto end = chrono::steady_clock::now() + 5s;
+  while (value < expected) {
+    if (chrono::steady_clock::now() > end)
+      return false;
+    this_thread::sleep_for(1ms);
+  }
+  return true;
+}
+
+// a share never runs more tasks at once than its limit
+static void limit() {
+  WorkerPool pool(4);
+  PoolShare share(2);
+  vector<unique_ptr<SerialExecutor>> executors;
+  atomic<int> running(0), maxRunning(0), done(0);
+  for (int i = 0; i < 8; ++i) {
+    executors.push_back(make_unique<SerialExecutor>(pool, &share));
+    for (int j = 0; j < 10; ++j) {
+      executors.back()->post([&]() {
+        int now = ++running;
+        int max = maxRunning;
+        while (now > max && !maxRunning.compare_exchange_weak(max, now))
+          ;
+        this_thread::sleep_for(100us);
+        running--;
+        done++;
+      });
+    }
+  }
+  check(waitUntil(done, 80), "all tasks ran");
+  check(maxRunning <= 2, "share limit kept");
+  for (auto &executor : executors)
+    executor->stop();
+}
+
+// a session whose handlers block keeps its share, the other one gets the
+// remaining threads
+static void isolation() {
+  WorkerPool pool(4);
+  PoolShare stalledShare(2), otherShare(2);
+  Gate gate;
+  vector<unique_ptr<SerialExecutor>> stalled;
+  atomic<int> blocked(0);
+  for (int i = 0; i < 4; ++i) {
+    stalled.push_back(make_unique<SerialExecutor>(pool, &stalledShare));
+    stalled.back()->post([&]() {
+      blocked++;
+      gate.wait();
+    });
+  }
+  check(waitUntil(blocked, 2), "stalled share runs");
+  SerialExecutor other(pool, &otherShare);
+  atomic<int> done(0);
+  for (int i = 0; i < 100; ++i)
+    other.post([&]() { done++; });
+  check(waitUntil(done, 100), "other share not starved");
+  check(blocked == 2, "stalled share held at its limit");
+  gate.release();
+  check(waitUntil(blocked, 4), "stalled share continues");
+  other.stop();
+  for (auto &executor : stalled)
+    executor->stop();
+}
+
+// an executor can move to another share from one of its own tasks, like a
+// client selecting a session
+static void moveShare() {
+  WorkerPool pool(2);
+  PoolShare full(1), free(1);
+  Gate gate;
+  atomic<int> blocked(0);
+  SerialExecutor blocker(pool, &full);
+  blocker.post([&]() {
+    blocked++;
+    gate.wait();
+  });
+  check(waitUntil(blocked, 1), "blocker runs");
+  SerialExecutor client(pool, &free);
+  atomic<int> done(0);
+  client.post([&]() {
+    client.setShare(&full);
+    done++;
+  });
+  client.post([&]() { done++; });
+  check(waitUntil(done, 1), "task of old share runs");
+  this_thread::sleep_for(50ms);
+  check(done == 1, "later task waits for the new share");
+  gate.release();
+  check(waitUntil(done, 2), "later task runs in the new share");
+  blocker.stop();
+  client.stop();
+}
+
+int main() {
+  limit();
+  isolation();
+  moveShare();
+  cout << "WorkerPoolTest passed" << endl;
+}
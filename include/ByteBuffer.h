@@ -0,0 +1,34 @@
+// Distributed under GPLv3 only as specified in repository's root LICENSE file
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#pragma once
+
+// Allocator that leaves elements created without a value uninitialized, so
+// resize() only reserves the bytes a following read or decrypt overwrites.
+template <typename T> class UninitializedAllocator : public std::allocator<T> {
+public:
+  template <typename U> struct rebind {
+    typedef UninitializedAllocator<U> other;
+  };
+
+  UninitializedAllocator() = default;
+  template <typename U>
+  UninitializedAllocator(const UninitializedAllocator<U> &) noexcept {}
+
+  template <typename U> void construct(U *p) noexcept(
+      std::is_nothrow_default_constructible<U>::value) {
+    ::new ((void *)p) U;
+  }
+  template <typename U, typename... Args>
+  void construct(U *p, Args &&...args) {
+    ::new ((void *)p) U(std::forward<Args>(args)...);
+  }
+};
+
+// Byte buffer whose resize() does not clear the added bytes
+typedef std::vector<uint8_t, UninitializedAllocator<uint8_t>> ByteBuffer;
@@ -25,7 +25,7 @@ ssize_t checkError(ssize_t ret, const std::vector<int> &ignoredErrors);
 void pushBackInt16(std::vector<uint8_t> &vec, uint16_t num);
 void pushBackInt64(std::vector<uint8_t> &vec, uint64_t num);
 std::string hexStr(uint8_t *data, int len);
-uint64_t bytesToUInt64(const std::vector<uint8_t> &vec, int offset);
+uint64_t bytesToUInt64(const uint8_t *vec, size_t size, int offset);
 
 class client_disconnected_error : public std::runtime_error {
 public:
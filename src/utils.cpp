@@ -57,9 +57,9 @@ std::string hexStr(uint8_t *data, int len) {
   return ss.str();
 }
 
-uint64_t bytesToUInt64(const std::vector<uint8_t> &vec, int offset) {
-  if (vec.size() - offset < 8)
-    throw runtime_error("bytesToUInt64: vector too small");
+uint64_t bytesToUInt64(const uint8_t *vec, size_t size, int offset) {
+  if (size < offset + 8)
+    throw runtime_error("bytesToUInt64: buffer too small");
   return ((uint64_t)vec[offset + 0] << 56) | ((uint64_t)vec[offset + 1] << 48) |
          ((uint64_t)vec[offset + 2] << 40) | ((uint64_t)vec[offset + 3] << 32) |
          ((uint64_t)vec[offset + 4] << 24) | ((uint64_t)vec[offset + 5] << 16) |